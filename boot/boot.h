@@ -0,0 +1,80 @@
+#ifndef JOS_BOOT_BOOT_H
+#define JOS_BOOT_BOOT_H
+
+/*
+ * Disk and memory layout shared by the two stages of the boot loader.
+ *
+ * DISK LAYOUT
+ *  * Sector 0 holds stage 1 (boot.S), the 512-byte boot block.
+ *
+ *  * Sectors 1 through BOOT2_NSECT hold stage 2 (boot2.S and the C
+ *    files).  BOOT2_NSECT is set in boot/Makefrag, which also pads
+ *    stage 2 out to exactly that many sectors.
+ *
+ *  * The kernel image starts at sector KERNSECT, right after stage 2.
+ *
+ *  * The kernel's swap area follows the kernel image (see kern/swap.c).
+ */
+
+#define SECTSIZE	512
+
+#define BOOT1_ADDR	0x7C00	// where the BIOS loads stage 1
+#define BOOT2_ADDR	0x7E00	// where stage 1 loads stage 2
+#define BOOT1_TSC	(BOOT1_ADDR - 8) // stage 1's TSC stamp, on its stack
+
+#define KERNSECT	(1 + BOOT2_NSECT)
+
+// Low memory the loader uses for its own purposes; the kernel is loaded
+// at 1MB and up, out of the way.
+#define SCRATCH_ADDR	0x10000	// kernel headers, disk probing
+#define VRING_ADDR	0x20000	// virtio queue (must be page aligned)
+#define VRING_MAXSIZE	0x10000
+
+#define MAXSECTS	256	// most sectors one IDE command can ask for
+#define MAXSECTS_EXT	65536	// ... with 48-bit LBA (the EXT commands)
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+#include <inc/bootinfo.h>
+
+extern struct bootinfo bootinfo;
+
+// boot2.S
+void start2_warm(void);
+
+// The BIOS memory map, as boot2.S collects it
+extern struct multiboot_mmap_entry e820_map[BOOTINFO_MAXMMAP];
+extern uint16_t e820_nent;
+
+// pci.c
+#define PCI_BDF(bus, dev, fn)	(((bus) << 8) | ((dev) << 3) | (fn))
+
+#define PCI_ID_REG		0x00
+#define PCI_COMMAND_REG		0x04
+#define   PCI_COMMAND_IO	0x00000001
+#define   PCI_COMMAND_MASTER	0x00000004
+#define PCI_CLASS_REG		0x08
+#define PCI_BHLC_REG		0x0C
+#define   PCI_MULTIFUNCTION	0x00800000
+#define PCI_BAR0_REG		0x10
+#define PCI_BAR4_REG		0x20
+
+uint32_t pci_conf_read(uint32_t bdf, uint32_t reg);
+void pci_conf_write(uint32_t bdf, uint32_t reg, uint32_t val);
+int pci_find(uint32_t reg, uint32_t mask, uint32_t val);
+
+// ide.c
+int ide_init(void);
+int ide_read(uint32_t pa, uint32_t secno, uint32_t nsect);
+
+// lz4.c
+uint32_t lz4_decompress(void *dst, const void *src, uint32_t srclen);
+
+// virtio.c
+int virtio_init(void);
+int virtio_read(uint32_t pa, uint32_t secno, uint32_t nsect);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_BOOT_BOOT_H */
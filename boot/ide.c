@@ -0,0 +1,252 @@
+#include <inc/x86.h>
+#include <inc/ide.h>
+#include <boot/boot.h>
+
+/*
+ * Boot loader driver for the primary IDE disk.
+ *
+ * If the IDE controller is a PCI bus master (PIIX and friends), reads
+ * use DMA: the controller walks a PRD (physical region descriptor)
+ * table and writes the sectors straight to their physical addresses.
+ * Otherwise, or if DMA fails, reads fall back to port I/O through
+ * 0x1F0, using READ MULTIPLE when the disk supports it.
+ *
+ * Disks that support 48-bit LBA get the EXT versions of the commands,
+ * which reach past 128GB and move up to 65536 sectors (32MB) at a time.
+ */
+
+// PCI class code of an IDE controller capable of bus mastering
+#define PCI_CLASS_IDE_BM	0x01018000
+#define PCI_CLASS_IDE_BM_MASK	0xFFFF8000
+
+// Bus master IDE registers, relative to BAR4 (primary channel)
+#define BM_CMD			0
+#define   BM_CMD_START		0x01
+#define   BM_CMD_WRITE		0x08	// device writes to memory
+#define BM_STATUS		2
+#define   BM_STATUS_ACTIVE	0x01
+#define   BM_STATUS_ERR		0x02
+#define   BM_STATUS_INTR	0x04
+#define BM_PRDT			4
+
+// A physical region descriptor.  No region may cross a 64KB boundary;
+// a count of 0 means 64KB.
+struct prd {
+	uint32_t pr_addr;
+	uint16_t pr_count;
+	uint16_t pr_flags;
+};
+#define PRD_EOT		0x8000	// last entry in the table
+
+// Enough regions for MAXSECTS_EXT sectors starting anywhere
+#define NPRD		(MAXSECTS_EXT * SECTSIZE / 0x10000 + 1)
+
+// The PRD table itself must not cross a 64KB boundary either;
+// all of stage 2 lies below 64KB, so it can't.
+static struct prd prdt[NPRD] __attribute__((__aligned__(32)));
+
+// Bus master I/O base, or 0 to use PIO
+static uint32_t bmbase;
+
+// Sectors per DRQ block for READ MULTIPLE, or 0 to use READ SECTORS
+static uint32_t multisect;
+
+// Nonzero if the disk supports 48-bit LBA
+static int lba48;
+
+// Wait for the disk to finish the current command.  If 'checkdrq',
+// also wait for it to have data ready for us.  Returns 0 on success,
+// -1 if the disk reports an error.
+static int
+waitdisk(int checkdrq)
+{
+	int r;
+
+	while (((r = inb(0x1F7)) & IDE_BSY)
+	       || (checkdrq && !(r & (IDE_DRQ|IDE_DF|IDE_ERR))))
+		/* do nothing */;
+	if (r & (IDE_DF|IDE_ERR))
+		return -1;
+	return 0;
+}
+
+// Issue 'cmd' for 'nsect' (1 to MAXSECTS, or MAXSECTS_EXT for an EXT
+// command) sectors starting at 'secno'.
+static int
+ide_command(uint8_t cmd, uint32_t secno, uint32_t nsect)
+{
+	// wait for disk to be ready
+	if (waitdisk(0) < 0)
+		return -1;
+
+	if (lba48) {
+		// Each register takes two bytes in a row, high-order first.
+		// Our sector numbers fit in 32 bits, so LBA bits 32-47 are 0.
+		outb(0x1F2, nsect >> 8);	// 65536 is sent as 0
+		outb(0x1F3, secno >> 24);
+		outb(0x1F4, 0);
+		outb(0x1F5, 0);
+		outb(0x1F2, nsect);
+		outb(0x1F3, secno);
+		outb(0x1F4, secno >> 8);
+		outb(0x1F5, secno >> 16);
+		outb(0x1F6, 0x40);
+	} else {
+		outb(0x1F2, nsect);	// count = nsect (256 is sent as 0)
+		outb(0x1F3, secno);
+		outb(0x1F4, secno >> 8);
+		outb(0x1F5, secno >> 16);
+		outb(0x1F6, (secno >> 24) | 0xE0);
+	}
+	outb(0x1F7, cmd);
+	return 0;
+}
+
+// Find a bus master IDE controller and set it up for DMA.
+static void
+ide_init_dma(void)
+{
+	int bdf;
+	uint32_t bar;
+
+	if ((bdf = pci_find(PCI_CLASS_REG, PCI_CLASS_IDE_BM_MASK,
+			    PCI_CLASS_IDE_BM)) < 0)
+		return;
+	bar = pci_conf_read(bdf, PCI_BAR4_REG);
+	if (!(bar & 1) || (bar & 0xFFFC) == 0)	// must be an I/O BAR
+		return;
+	pci_conf_write(bdf, PCI_COMMAND_REG, pci_conf_read(bdf, PCI_COMMAND_REG)
+		       | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+	bmbase = bar & 0xFFFC;
+}
+
+// Ask the disk about itself.  Pick DMA if the disk and controller can
+// both do it; otherwise switch the disk into READ MULTIPLE mode with its
+// largest block size, so that PIO waits on the disk once per block
+// instead of once per sector.  Returns the BOOTDISK_ method chosen.
+int
+ide_init(void)
+{
+	uint16_t id[SECTSIZE/2];
+
+	waitdisk(0);
+	outb(0x1F6, 0xE0);
+	outb(0x1F7, IDE_CMD_IDENTIFY);
+	if (waitdisk(1) < 0)
+		return BOOTDISK_PIO;
+	insl(0x1F0, id, SECTSIZE/4);
+
+	lba48 = ide_id_lba48(id);
+
+	// Word 49 bit 8: the disk supports DMA
+	if (id[49] & 0x100) {
+		ide_init_dma();
+		if (bmbase)
+			return BOOTDISK_DMA;
+	}
+
+	// Word 47 holds the largest block size READ MULTIPLE supports
+	if ((id[47] & 0xFF) == 0)
+		return BOOTDISK_PIO;
+	outb(0x1F2, id[47] & 0xFF);
+	outb(0x1F6, 0xE0);
+	outb(0x1F7, IDE_CMD_SET_MULTIPLE);
+	if (waitdisk(0) == 0)
+		multisect = id[47] & 0xFF;
+	return BOOTDISK_PIO;
+}
+
+static int
+ide_read_dma(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	struct prd *pr;
+	uint32_t n, len;
+	uint8_t status;
+
+	// Describe the buffer in regions that don't cross 64KB boundaries.
+	for (pr = prdt, n = nsect * SECTSIZE; n > 0; pr++, pa += len, n -= len) {
+		len = MIN(n, 0x10000 - (pa & 0xFFFF));
+		pr->pr_addr = pa;
+		pr->pr_count = len;	// 64KB truncates to 0, as it should
+		pr->pr_flags = 0;
+	}
+	pr[-1].pr_flags = PRD_EOT;
+
+	outb(bmbase + BM_CMD, 0);
+	outl(bmbase + BM_PRDT, (uint32_t) prdt);
+	// clear any stale error and interrupt indications (write 1 to clear)
+	outb(bmbase + BM_STATUS, inb(bmbase + BM_STATUS)
+	     | BM_STATUS_ERR | BM_STATUS_INTR);
+	outb(bmbase + BM_CMD, BM_CMD_WRITE);
+
+	if (ide_command(lba48 ? IDE_CMD_READ_DMA_EXT : IDE_CMD_READ_DMA,
+			secno, nsect) < 0)
+		return -1;
+	outb(bmbase + BM_CMD, BM_CMD_WRITE | BM_CMD_START);
+
+	// The controller drops ACTIVE and raises INTR when it's done.
+	while (((status = inb(bmbase + BM_STATUS))
+		& (BM_STATUS_ACTIVE|BM_STATUS_ERR|BM_STATUS_INTR)) == BM_STATUS_ACTIVE)
+		/* do nothing */;
+	outb(bmbase + BM_CMD, 0);
+
+	if ((status & BM_STATUS_ERR) || waitdisk(0) < 0)
+		return -1;
+	return 0;
+}
+
+static int
+ide_read_pio(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	uint8_t *p = (uint8_t *) pa;
+	uint32_t n;
+	uint8_t cmd;
+
+	if (multisect)
+		cmd = lba48 ? IDE_CMD_READ_MULTIPLE_EXT : IDE_CMD_READ_MULTIPLE;
+	else
+		cmd = lba48 ? IDE_CMD_READ_EXT : IDE_CMD_READ;
+	if (ide_command(cmd, secno, nsect) < 0)
+		return -1;
+
+	// The drive raises DRQ once per block (one sector, or 'multisect'
+	// sectors in READ MULTIPLE mode) until the transfer is done.
+	while (nsect > 0) {
+		n = multisect ? MIN(nsect, multisect) : 1;
+		if (waitdisk(1) < 0)
+			return -1;
+		insl(0x1F0, p, n * SECTSIZE/4);
+		p += n * SECTSIZE;
+		nsect -= n;
+	}
+	return 0;
+}
+
+static int
+ide_read_one(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	if (bmbase) {
+		if (ide_read_dma(pa, secno, nsect) == 0)
+			return 0;
+		// DMA didn't work out; use PIO from now on.
+		bmbase = 0;
+		bootinfo.bi_disk = BOOTDISK_PIO;
+	}
+	return ide_read_pio(pa, secno, nsect);
+}
+
+// Read 'nsect' consecutive sectors starting at sector 'secno' into
+// physical address 'pa'.  Returns 0 on success, -1 on error.
+int
+ide_read(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	uint32_t n;
+
+	// One disk command per MAXSECTS (MAXSECTS_EXT) sectors
+	for (; nsect > 0; pa += n * SECTSIZE, secno += n, nsect -= n) {
+		n = MIN(nsect, lba48 ? MAXSECTS_EXT : MAXSECTS);
+		if (ide_read_one(pa, secno, n) < 0)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include <inc/types.h>
+#include <boot/boot.h>
+
+/*
+ * LZ4 block decompression, for kernel segments boot/mkkimg compressed.
+ *
+ * A block is a series of sequences.  Each starts with a token byte whose
+ * high nibble is a literal count and low nibble a match length minus 4;
+ * a nibble of 15 means more length bytes follow, each added in, until
+ * one is not 255.  Then come the literals, then a 2-byte little-endian
+ * offset back into the output where the match is copied from.  The last
+ * sequence of a block has literals only.
+ */
+
+// Read the rest of a length whose nibble was 'len'.
+static uint32_t
+lz4_len(const uint8_t **src, uint32_t len)
+{
+	uint8_t b;
+
+	if (len == 15)
+		do {
+			b = *(*src)++;
+			len += b;
+		} while (b == 255);
+	return len;
+}
+
+// Decompress the 'srclen'-byte LZ4 block at 'src' into 'dst'.
+// Returns the number of bytes written to 'dst'.
+uint32_t
+lz4_decompress(void *dst, const void *src, uint32_t srclen)
+{
+	const uint8_t *ip = src, *iend = ip + srclen;
+	uint8_t *op = dst;
+	const uint8_t *match;
+	uint32_t len;
+	uint8_t token;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		// literals
+		len = lz4_len(&ip, token >> 4);
+		while (len-- > 0)
+			*op++ = *ip++;
+		if (ip >= iend)
+			break;
+
+		// match, which may overlap what it's producing
+		match = op - (ip[0] | (ip[1] << 8));
+		ip += 2;
+		len = lz4_len(&ip, token & 15) + 4;
+		while (len-- > 0)
+			*op++ = *match++;
+	}
+	return op - (uint8_t *) dst;
+}
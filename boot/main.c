@@ -1,63 +1,161 @@
 #include <inc/x86.h>
-#include <inc/elf.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/bootinfo.h>
+#include <inc/kimg.h>
+#include <boot/boot.h>
 
 /**********************************************************************
- * This a dirt simple boot loader, whose sole job is to boot
- * an ELF kernel image from the first IDE hard disk.
+ * This is stage 2 of the boot loader, whose sole job is to boot
+ * a kernel image from the boot disk, quickly.  The boot disk is
+ * either a virtio block device (virtio.c) or, failing that, the first
+ * IDE hard disk (ide.c).
  *
  * DISK LAYOUT
- *  * This program(boot.S and main.c) is the bootloader.  It should
- *    be stored in the first sector of the disk.
- * 
- *  * The 2nd sector onward holds the kernel image.
- *	
- *  * The kernel image must be in ELF format.
+ *  * See boot/boot.h.  Stage 1 (boot.S) is in the first sector of the
+ *    disk, this program (boot2.S and main.c) in the sectors after it.
  *
- * BOOT UP STEPS	
+ *  * The kernel image follows stage 2, starting at sector KERNSECT.
+ *
+ *  * The kernel image is the kernel's ELF file packed by boot/mkkimg:
+ *    a header sector (struct kimg, see inc/kimg.h) indexing the
+ *    contents of each loadable segment, each starting on a sector
+ *    boundary and mostly LZ4-compressed.  We read each segment with
+ *    one streaming read, straight to where it belongs if it's stored
+ *    as is, and otherwise to memory past the end of the kernel to be
+ *    decompressed into place.
+ *
+ * BOOT UP STEPS
  *  * when the CPU boots it loads the BIOS into memory and executes it
  *
  *  * the BIOS intializes devices, sets of the interrupt routines, and
- *    reads the first sector of the boot device(e.g., hard-drive) 
+ *    reads the first sector of the boot device(e.g., hard-drive)
  *    into memory and jumps to it.
  *
- *  * Assuming this boot loader is stored in the first sector of the
- *    hard-drive, this code takes over...
+ *  * Assuming stage 1 is stored in the first sector of the
+ *    hard-drive, it has the BIOS read stage 2 and jumps to it.
  *
- *  * control starts in boot.S -- which sets up protected mode,
+ *  * control continues in boot2.S -- which sets up protected mode,
  *    and a stack so C code then run, then calls bootmain()
  *
- *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *  * bootmain() in this file takes over, reads in the kernel and jumps
+ *    to it, passing a struct bootinfo (see inc/bootinfo.h).
  **********************************************************************/
 
-#define SECTSIZE	512
-#define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define KIMGHDR		((struct kimg *) SCRATCH_ADDR)
+
+struct bootinfo bootinfo;
 
-void readsect(void*, uint32_t);
-void readseg(uint32_t, uint32_t, uint32_t);
+// These live in .data, not the BSS, so that kexec's copy of the loader
+// (see bi_loader) has the memory map in it.  Stage 2 must not change any
+// other initialized data, or a warm boot would see the changes.
+struct multiboot_mmap_entry e820_map[BOOTINFO_MAXMMAP] __attribute__((section(".data")));
+uint16_t e820_nent __attribute__((section(".data")));
 
+// Read sectors from the boot disk: virtio_read or ide_read
+static int (*disk_read)(uint32_t pa, uint32_t secno, uint32_t nsect);
+
+static void memmap(void);
+static int readseg(uint32_t, uint32_t, uint32_t);
+static void zeroseg(uint32_t, uint32_t);
+
+// 'flags' is 0 on a cold boot, BOOTFLAG_WARM when kexec reloads us.
 void
-bootmain(void)
+bootmain(uint32_t flags)
 {
-	struct Proghdr *ph, *eph;
+	extern char edata[];
+	struct kimg_seg *ks;
+	struct bootseg *bs;
+	uint32_t data, src[KIMG_MAXSEG];
+	int i;
+
+	bootinfo.bi_tsc[BOOTPHASE_STAGE1] = *(uint64_t *) BOOT1_TSC;
+	bootinfo.bi_tsc[BOOTPHASE_STAGE2] = read_tsc();
+	bootinfo.bi_flags = flags;
+
+	// Tell the kernel where we are, stage 1 included (virtio_init
+	// checks the boot disk against it), so it can run us again.
+	bootinfo.bi_loader = BOOT1_ADDR;
+	bootinfo.bi_loadersize = (uint32_t) edata - BOOT1_ADDR;
+	bootinfo.bi_loaderwarm = (uint32_t) start2_warm;
+
+	memmap();
+
+	if (virtio_init() == 0) {
+		bootinfo.bi_disk = BOOTDISK_VIRTIO;
+		disk_read = virtio_read;
+	} else {
+		bootinfo.bi_disk = ide_init();
+		disk_read = ide_read;
+	}
 
-	// read 1st page off disk
-	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
+	// read the header sector off disk
+	bootinfo.bi_tsc[BOOTPHASE_LOAD] = read_tsc();
+	if (readseg((uint32_t) KIMGHDR, KIMG_HDRSIZE, 0) < 0)
+		goto bad;
 
-	// is this a valid ELF?
-	if (ELFHDR->e_magic != ELF_MAGIC)
+	// is this a valid kernel image?
+	if (KIMGHDR->ki_magic != KIMG_MAGIC || KIMGHDR->ki_nseg > KIMG_MAXSEG
+	    || KIMGHDR->ki_size < KIMG_HDRSIZE)
 		goto bad;
+	bootinfo.bi_kimgend = KERNSECT
+		+ ROUNDUP(KIMGHDR->ki_size, SECTSIZE) / SECTSIZE;
+
+	// Record each segment in the segment table, which gives the kernel
+	// an exact account of what we loaded where, and find the end of
+	// the highest one: segments we can't read in place go right above
+	// it, where unpacking them can't overwrite them.
+	data = 0;
+	for (ks = KIMGHDR->ki_seg; ks < KIMGHDR->ki_seg + KIMGHDR->ki_nseg; ks++) {
+		bs = &bootinfo.bi_seg[bootinfo.bi_nseg++];
+		bs->bs_pa = ks->ks_pa;
+		bs->bs_filesz = ks->ks_filesz;
+		bs->bs_memsz = ks->ks_memsz;
+		bs->bs_disksz = ks->ks_size;
+		data = MAX(data, ks->ks_pa + ks->ks_memsz);
+	}
+	data = ROUNDUP(data, SECTSIZE);
+
+	// Read each segment with one call.  One stored as is goes straight
+	// to its load address if that's sector aligned and the whole
+	// sectors fit in its memory; the rest go to 'data'.
+	for (i = 0; i < KIMGHDR->ki_nseg; i++) {
+		ks = &KIMGHDR->ki_seg[i];
+		if (!(ks->ks_flags & KSEG_LZ4) && ks->ks_pa % SECTSIZE == 0
+		    && ROUNDUP(ks->ks_size, SECTSIZE) <= ks->ks_memsz)
+			src[i] = ks->ks_pa;
+		else {
+			src[i] = data;
+			data += ROUNDUP(ks->ks_size, SECTSIZE);
+		}
+		if (readseg(src[i], ks->ks_size, ks->ks_offset) < 0)
+			goto bad;
+	}
+
+	// Now put the segments we couldn't read in place where they belong.
+	bootinfo.bi_tsc[BOOTPHASE_UNPACK] = read_tsc();
+	for (i = 0; i < KIMGHDR->ki_nseg; i++) {
+		ks = &KIMGHDR->ki_seg[i];
+		if (ks->ks_flags & KSEG_LZ4) {
+			if (lz4_decompress((void *) ks->ks_pa, (void *) src[i],
+					   ks->ks_size) != ks->ks_filesz)
+				goto bad;
+		} else if (src[i] != ks->ks_pa)
+			memmove((void *) ks->ks_pa, (void *) src[i], ks->ks_size);
+	}
 
-	// load each program segment (ignores ph flags)
-	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
-	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
-		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+	// Zero the rest of each segment (the BSS), and tell the kernel
+	// not to bother doing it again.
+	for (bs = bootinfo.bi_seg; bs < bootinfo.bi_seg + bootinfo.bi_nseg; bs++)
+		zeroseg(bs->bs_pa + bs->bs_filesz, bs->bs_pa + bs->bs_memsz);
+	bootinfo.bi_flags |= BOOTFLAG_BSSZERO;
 
-	// call the entry point from the ELF header
+	// call the entry point from the image header, handing over the
+	// bootinfo the way a Multiboot loader would
 	// note: does not return!
-	((void (*)(void)) (ELFHDR->e_entry))();
+	bootinfo.bi_tsc[BOOTPHASE_KERNEL] = read_tsc();
+	__asm __volatile("jmp *%0" : :
+			 "r" (KIMGHDR->ki_entry), "a" (BOOTINFO_MAGIC), "b" (&bootinfo));
 
 bad:
 	outw(0x8A00, 0x8A00);
@@ -66,60 +164,67 @@ bad:
 		/* do nothing */;
 }
 
-// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
-// Might copy more than asked
-void
-readseg(uint32_t pa, uint32_t count, uint32_t offset)
+// Pass the BIOS memory map boot2.S collected on to the kernel, the way
+// a Multiboot loader would, along with the amount of memory from 0 and
+// from 1MB on that it implies.
+static void
+memmap(void)
 {
-	uint32_t end_pa;
-
-	end_pa = pa + count;
-	
-	// round down to sector boundary
-	pa &= ~(SECTSIZE - 1);
-
-	// translate from bytes to sectors, and kernel starts at sector 1
-	offset = (offset / SECTSIZE) + 1;
-
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
-	while (pa < end_pa) {
-		// Since we haven't enabled paging yet and we're using
-		// an identity segment mapping (see boot.S), we can
-		// use physical addresses directly.  This won't be the
-		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+	struct multiboot_info *mbi = &bootinfo.bi_mbi;
+	struct multiboot_mmap_entry *e, *mm = bootinfo.bi_mmap;
+
+	for (e = e820_map; e < e820_map + e820_nent; e++) {
+		if (e->mm_len == 0)
+			continue;
+		*mm++ = *e;
+		if (e->mm_type != MULTIBOOT_MEMORY_AVAILABLE)
+			continue;
+		if (e->mm_addr == 0)
+			mbi->mi_mem_lower = e->mm_len / 1024;
+		else if (e->mm_addr <= EXTPHYSMEM
+			 && e->mm_addr + e->mm_len > EXTPHYSMEM)
+			mbi->mi_mem_upper = (e->mm_addr + e->mm_len - EXTPHYSMEM) / 1024;
 	}
+	if (mm == bootinfo.bi_mmap)
+		return;
+	mbi->mi_mmap_addr = (uint32_t) bootinfo.bi_mmap;
+	mbi->mi_mmap_length = (uint8_t *) mm - (uint8_t *) bootinfo.bi_mmap;
+	mbi->mi_flags |= MULTIBOOT_INFO_MEMORY | MULTIBOOT_INFO_MEM_MAP;
 }
 
-void
-waitdisk(void)
+// Read 'count' bytes at sector-aligned 'offset' in the kernel image
+// into physical address 'pa'.  Reads whole sectors, so it may write up
+// to SECTSIZE-1 bytes past the end of what was asked for.
+static int
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	// wait for disk reaady
-	while ((inb(0x1F7) & 0xC0) != 0x40)
-		/* do nothing */;
+	if (count == 0)
+		return 0;
+
+	// Read it all with one call, which costs one request on virtio
+	// and one command per MAXSECTS (MAXSECTS_EXT) sectors on IDE.
+	// Since we haven't enabled paging yet and we're using
+	// an identity segment mapping (see boot2.S), we can
+	// use physical addresses directly.  This won't be the
+	// case once JOS enables the MMU.
+	return disk_read(pa, KERNSECT + offset / SECTSIZE,
+			 (count + SECTSIZE - 1) / SECTSIZE);
 }
 
-void
-readsect(void *dst, uint32_t offset)
+// Zero physical memory [pa, end_pa), using word stores for all but the
+// unaligned bytes at either end.
+static void
+zeroseg(uint32_t pa, uint32_t end_pa)
 {
-	// wait for disk to be ready
-	waitdisk();
-
-	outb(0x1F2, 1);		// count = 1
-	outb(0x1F3, offset);
-	outb(0x1F4, offset >> 8);
-	outb(0x1F5, offset >> 16);
-	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
-
-	// wait for disk to be ready
-	waitdisk();
+	uint32_t head, tail;
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	head = ROUNDUP(pa, 4);
+	tail = ROUNDDOWN(end_pa, 4);
+	if (head >= tail) {
+		memset((void *) pa, 0, end_pa - pa);
+		return;
+	}
+	memset((void *) pa, 0, head - pa);
+	memset((void *) head, 0, tail - head);	// aligned: rep stosl
+	memset((void *) tail, 0, end_pa - tail);
 }
-
@@ -0,0 +1,197 @@
+/*
+ * mkkimg: turn the kernel's ELF file into the image the boot loader
+ * reads (see inc/kimg.h).  Built for and run on the host.
+ *
+ *	mkkimg kernel kernel.kimg
+ *
+ * Only loadable segments make it into the image, each starting on a
+ * sector boundary and LZ4-compressed if that saves sectors.  The loader
+ * reads each segment in one go, straight to its load address if it's
+ * stored as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include <inc/elf.h>
+#include <inc/kimg.h>
+
+#define MINMATCH	4	// shortest match LZ4 can encode
+#define LASTLITERALS	5	// a block must end in this many literals
+#define MFLIMIT		12	// and its last match must start before this
+#define MAXOFFSET	65535
+#define HASHBITS	16
+
+#define ROUNDUP(n, a)	(((n) + (a) - 1) / (a) * (a))
+
+static void
+panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "mkkimg: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(1);
+}
+
+static uint32_t
+hash4(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return (v * 2654435761U) >> (32 - HASHBITS);
+}
+
+// Append the length 'len', beyond the 15 its token nibble holds.
+static uint8_t *
+putlen(uint8_t *op, size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+// Append a sequence: 'litlen' literals from 'lit', then, unless 'mlen'
+// is 0, a match of 'mlen' bytes 'off' bytes back.
+static uint8_t *
+putseq(uint8_t *op, const uint8_t *lit, size_t litlen, size_t off, size_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = (litlen < 15 ? litlen : 15) << 4;
+	if (litlen >= 15)
+		op = putlen(op, litlen);
+	memcpy(op, lit, litlen);
+	op += litlen;
+	if (mlen == 0)
+		return op;
+
+	*op++ = off;
+	*op++ = off >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		op = putlen(op, mlen);
+	return op;
+}
+
+// Compress 'n' bytes at 'src' into an LZ4 block at 'dst', which must
+// have room for LZ4_BOUND(n) bytes.  Greedy matching against the last
+// position each 4-byte hash was seen at; that's fast and good enough.
+#define LZ4_BOUND(n)	((n) + (n) / 255 + 16)
+
+static size_t
+lz4_compress(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	static int32_t table[1 << HASHBITS];
+	const uint8_t *ip = src, *anchor = src, *iend = src + n;
+	const uint8_t *match, *p, *m;
+	uint8_t *op = dst;
+	uint32_t h;
+
+	memset(table, 0xFF, sizeof(table));
+	while (n > MFLIMIT && ip < iend - MFLIMIT) {
+		h = hash4(ip);
+		match = table[h] < 0 ? NULL : src + table[h];
+		table[h] = ip - src;
+		if (match == NULL || ip - match > MAXOFFSET
+		    || memcmp(match, ip, MINMATCH) != 0) {
+			ip++;
+			continue;
+		}
+		p = ip + MINMATCH;
+		m = match + MINMATCH;
+		while (p < iend - LASTLITERALS && *p == *m)
+			p++, m++;
+		op = putseq(op, anchor, ip - anchor, ip - match, p - ip);
+		ip = anchor = p;
+	}
+	op = putseq(op, anchor, iend - anchor, 0, 0);
+	return op - dst;
+}
+
+static void
+readn(FILE *f, void *buf, size_t n, uint32_t off)
+{
+	if (fseek(f, off, SEEK_SET) < 0 || fread(buf, 1, n, f) != n)
+		panic("short read at offset %u", off);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *in, *out;
+	struct Elf elf;
+	struct Proghdr ph;
+	struct kimg ki;
+	struct kimg_seg *ks;
+	uint8_t *raw, *z;
+	size_t zlen;
+	int i;
+
+	if (argc != 3)
+		panic("usage: mkkimg kernel kernel.kimg");
+	if ((in = fopen(argv[1], "rb")) == NULL)
+		panic("open %s: %s", argv[1], strerror(errno));
+	if ((out = fopen(argv[2], "wb")) == NULL)
+		panic("create %s: %s", argv[2], strerror(errno));
+
+	readn(in, &elf, sizeof(elf), 0);
+	if (elf.e_magic != ELF_MAGIC)
+		panic("%s: not an ELF file", argv[1]);
+
+	memset(&ki, 0, sizeof(ki));
+	ki.ki_magic = KIMG_MAGIC;
+	ki.ki_entry = elf.e_entry;
+	ki.ki_size = KIMG_HDRSIZE;
+
+	for (i = 0; i < elf.e_phnum; i++) {
+		readn(in, &ph, sizeof(ph), elf.e_phoff + i * sizeof(ph));
+		if (ph.p_type != ELF_PROG_LOAD || ph.p_memsz == 0)
+			continue;
+		if (ki.ki_nseg == KIMG_MAXSEG)
+			panic("%s: more than %d loadable segments",
+			      argv[1], KIMG_MAXSEG);
+
+		ks = &ki.ki_seg[ki.ki_nseg++];
+		ks->ks_pa = ph.p_pa;
+		ks->ks_filesz = ph.p_filesz;
+		ks->ks_memsz = ph.p_memsz;
+		ks->ks_offset = ROUNDUP(ki.ki_size, KIMG_ALIGN);
+
+		if ((raw = malloc(ph.p_filesz + 1)) == NULL
+		    || (z = malloc(LZ4_BOUND(ph.p_filesz))) == NULL)
+			panic("out of memory");
+		readn(in, raw, ph.p_filesz, ph.p_offset);
+		zlen = lz4_compress(z, raw, ph.p_filesz);
+		if (fseek(out, ks->ks_offset, SEEK_SET) < 0)
+			panic("seek %s: %s", argv[2], strerror(errno));
+		if (ROUNDUP(zlen, KIMG_ALIGN) < ROUNDUP(ph.p_filesz, KIMG_ALIGN)) {
+			ks->ks_size = zlen;
+			ks->ks_flags = KSEG_LZ4;
+			fwrite(z, 1, zlen, out);
+		} else {
+			ks->ks_size = ph.p_filesz;
+			fwrite(raw, 1, ph.p_filesz, out);
+		}
+		ki.ki_size = ks->ks_offset + ks->ks_size;
+		free(raw);
+		free(z);
+	}
+
+	if (fseek(out, 0, SEEK_SET) < 0
+	    || fwrite(&ki, 1, sizeof(ki), out) != sizeof(ki)
+	    || fclose(out) != 0)
+		panic("write %s: %s", argv[2], strerror(errno));
+	fclose(in);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/perl
+
+# Pad a boot loader stage out to a whole number of sectors:
+#	pad.pl file nsect
+
+open(BB, $ARGV[0]) || die "open $ARGV[0]: $!";
+$max = 512 * $ARGV[1];
+
+binmode BB;
+my $buf;
+read(BB, $buf, $max + 1);
+$n = length($buf);
+
+if($n > $max){
+	print STDERR "boot stage too large: $n bytes (max $max)\n";
+	exit 1;
+}
+
+print STDERR "boot stage is $n bytes (max $max)\n";
+
+$buf .= "\0" x ($max-$n);
+
+open(BB, ">$ARGV[0]") || die "open >$ARGV[0]: $!";
+binmode BB;
+print BB $buf;
+close BB;
@@ -0,0 +1,49 @@
+#include <inc/x86.h>
+#include <boot/boot.h>
+
+/*
+ * Just enough PCI configuration space access (mechanism #1) for the
+ * boot loader to find a disk controller.  Only bus 0 is scanned, which
+ * is where QEMU and the PC chipsets we boot on put their controllers.
+ */
+
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+uint32_t
+pci_conf_read(uint32_t bdf, uint32_t reg)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (bdf << 8) | reg);
+	return inl(PCI_CONF_DATA);
+}
+
+void
+pci_conf_write(uint32_t bdf, uint32_t reg, uint32_t val)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (bdf << 8) | reg);
+	outl(PCI_CONF_DATA, val);
+}
+
+// Find the first function on bus 0 whose configuration register 'reg',
+// masked with 'mask', equals 'val'.  Returns its bus/device/function
+// number (see PCI_BDF), or -1 if there is none.
+int
+pci_find(uint32_t reg, uint32_t mask, uint32_t val)
+{
+	uint32_t dev, fn, nfn, bdf;
+
+	for (dev = 0; dev < 32; dev++) {
+		nfn = 1;
+		for (fn = 0; fn < nfn; fn++) {
+			bdf = PCI_BDF(0, dev, fn);
+			if ((pci_conf_read(bdf, PCI_ID_REG) & 0xFFFF) == 0xFFFF)
+				continue;
+			if (fn == 0
+			    && (pci_conf_read(bdf, PCI_BHLC_REG) & PCI_MULTIFUNCTION))
+				nfn = 8;
+			if ((pci_conf_read(bdf, reg) & mask) == val)
+				return bdf;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,169 @@
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <boot/boot.h>
+
+/*
+ * Boot loader driver for a virtio block device (legacy PCI interface),
+ * which is much cheaper to emulate than IDE.  There's one virtqueue,
+ * polled, with one request in flight at a time; each request moves a
+ * whole run of sectors straight to its physical address.
+ */
+
+#define VIRTIO_BLK_ID		0x10011AF4	// device 0x1001, vendor 0x1AF4
+
+// Legacy virtio registers, relative to BAR0
+#define VIRTIO_GUEST_FEATURES	0x04
+#define VIRTIO_QUEUE_PFN	0x08
+#define VIRTIO_QUEUE_NUM	0x0C
+#define VIRTIO_QUEUE_SEL	0x0E
+#define VIRTIO_QUEUE_NOTIFY	0x10
+#define VIRTIO_STATUS		0x12
+#define   VIRTIO_STATUS_ACK	0x01
+#define   VIRTIO_STATUS_DRIVER	0x02
+#define   VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_ISR		0x13
+
+#define VRING_ALIGN		4096
+
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+#define VRING_DESC_F_NEXT	1
+#define VRING_DESC_F_WRITE	2	// device writes this buffer
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+};
+
+struct vring_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct vring_used_elem ring[];
+};
+
+struct virtio_blk_req {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+};
+#define VIRTIO_BLK_T_IN		0
+
+static uint32_t iobase;
+static uint32_t qsz;
+static volatile struct vring_desc *desc;
+static volatile struct vring_avail *avail;
+static volatile struct vring_used *used;
+static uint16_t last_used;
+
+static struct virtio_blk_req req;
+static volatile uint8_t req_status;
+
+// Bytes of memory a virtqueue with 'n' entries occupies
+static uint32_t
+vring_size(uint32_t n)
+{
+	return ROUNDUP(16 * n + 6 + 2 * n, VRING_ALIGN) + 6 + 8 * n;
+}
+
+// Find and set up a virtio block device.  Returns 0 if it's ready to
+// read from and is the disk we booted from, -1 otherwise.
+int
+virtio_init(void)
+{
+	int bdf;
+	uint32_t bar;
+
+	if ((bdf = pci_find(PCI_ID_REG, 0xFFFFFFFF, VIRTIO_BLK_ID)) < 0)
+		return -1;
+	bar = pci_conf_read(bdf, PCI_BAR0_REG);
+	if (!(bar & 1))		// legacy devices have an I/O BAR0
+		return -1;
+	pci_conf_write(bdf, PCI_COMMAND_REG, pci_conf_read(bdf, PCI_COMMAND_REG)
+		       | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+	iobase = bar & 0xFFFC;
+
+	// Reset the device and tell it we're here; we need no features.
+	outb(iobase + VIRTIO_STATUS, 0);
+	outb(iobase + VIRTIO_STATUS, VIRTIO_STATUS_ACK);
+	outb(iobase + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+	outl(iobase + VIRTIO_GUEST_FEATURES, 0);
+
+	// Lay out queue 0 at VRING_ADDR, in the size the device dictates.
+	outw(iobase + VIRTIO_QUEUE_SEL, 0);
+	qsz = inw(iobase + VIRTIO_QUEUE_NUM);
+	if (qsz == 0 || vring_size(qsz) > VRING_MAXSIZE)
+		goto fail;
+	memset((void *) VRING_ADDR, 0, vring_size(qsz));
+	desc = (struct vring_desc *) VRING_ADDR;
+	avail = (struct vring_avail *) (desc + qsz);
+	used = (struct vring_used *) ROUNDUP((uint32_t) &avail->ring[qsz + 1],
+					     VRING_ALIGN);
+	last_used = 0;
+	outl(iobase + VIRTIO_QUEUE_PFN, VRING_ADDR / VRING_ALIGN);
+	outb(iobase + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+	     | VIRTIO_STATUS_DRIVER_OK);
+
+	// Make sure this is the disk the BIOS booted us from, not some
+	// other disk that happens to be virtio: its sector 0 is stage 1.
+	if (virtio_read(SCRATCH_ADDR, 0, 1) < 0
+	    || memcmp((void *) SCRATCH_ADDR, (void *) BOOT1_ADDR, SECTSIZE) != 0)
+		goto fail;
+	return 0;
+
+fail:
+	outb(iobase + VIRTIO_STATUS, 0);
+	return -1;
+}
+
+// Read 'nsect' consecutive sectors starting at sector 'secno' into
+// physical address 'pa', as a single request.
+// Returns 0 on success, -1 on error.
+int
+virtio_read(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	uint16_t i;
+
+	req.type = VIRTIO_BLK_T_IN;
+	req.reserved = 0;
+	req.sector = secno;
+	req_status = 0xFF;
+
+	// A request is a chain of three descriptors:
+	// header (device reads), data and status (device writes).
+	desc[0].addr = (uint32_t) &req;
+	desc[0].len = sizeof(req);
+	desc[0].flags = VRING_DESC_F_NEXT;
+	desc[0].next = 1;
+	desc[1].addr = pa;
+	desc[1].len = nsect * SECTSIZE;
+	desc[1].flags = VRING_DESC_F_NEXT | VRING_DESC_F_WRITE;
+	desc[1].next = 2;
+	desc[2].addr = (uint32_t) &req_status;
+	desc[2].len = 1;
+	desc[2].flags = VRING_DESC_F_WRITE;
+	desc[2].next = 0;
+
+	i = avail->idx;
+	avail->ring[i % qsz] = 0;
+	__asm __volatile("" : : : "memory");	// publish the request first
+	avail->idx = i + 1;
+	outw(iobase + VIRTIO_QUEUE_NOTIFY, 0);
+
+	while (used->idx == last_used)
+		/* do nothing */;
+	last_used++;
+	(void) inb(iobase + VIRTIO_ISR);	// acknowledge the interrupt
+	__asm __volatile("" : : : "memory");
+
+	return req_status == 0 ? 0 : -1;
+}
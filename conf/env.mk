@@ -18,3 +18,9 @@ V = @
 # following line and set it to the full path to QEMU.
 #
 QEMU=/usr/local/jos/bin/qemu-system-i386
+
+# Set PAE to build the kernel to use PAE paging: 64-bit page table
+# entries, 2MB large pages, and no-execute pages on CPUs that have them.
+# Run 'make clean' after changing it.
+#
+# PAE=1
@@ -0,0 +1,78 @@
+#ifndef JOS_INC_BOOTINFO_H
+#define JOS_INC_BOOTINFO_H
+
+/*
+ * The boot loader describes what it did in a struct bootinfo.  When it
+ * jumps to the kernel, %eax holds BOOTINFO_MAGIC and %ebx holds the
+ * physical address of the structure -- the same register convention a
+ * Multiboot loader uses -- so the kernel can tell whether it was loaded
+ * by our boot loader or by something else.
+ *
+ * The BIOS memory map comes in a Multiboot information structure, so the
+ * kernel reads it the same way whether we or GRUB loaded it.
+ */
+
+#include <inc/multiboot.h>
+
+#define BOOTINFO_MAGIC	0x4A4F5342	// "BSOJ"
+
+#define BOOTINFO_MAXSEG	8		// max kernel segments recorded
+#define BOOTINFO_MAXMMAP 32		// max memory map entries recorded
+
+// Boot phases stamped with the TSC (indexes into bi_tsc).  The TSC
+// starts counting at reset, so the first stamp is the time the BIOS took.
+#define BOOTPHASE_STAGE1	0	// the BIOS jumped to stage 1
+#define BOOTPHASE_STAGE2	1	// stage 2 entered protected mode
+#define BOOTPHASE_LOAD		2	// started loading the kernel
+#define BOOTPHASE_UNPACK	3	// read the kernel image, unpacking it
+#define BOOTPHASE_KERNEL	4	// jumped to the kernel entry point
+#define BOOTPHASE_PAGING	5	// entry.S turned on paging
+#define BOOTPHASE_INIT		6	// entered i386_init
+#define BOOTPHASE_BSS		7	// cleared the BSS
+#define BOOTPHASE_CONS		8	// set up the console
+#define BOOTPHASE_MONITOR	9	// about to start the monitor
+#define NBOOTPHASE		10
+
+// Offset of bi_tsc in struct bootinfo, for entry.S
+#define BOOTINFO_TSC		0
+
+// How the boot loader read the kernel off the disk (bi_disk)
+#define BOOTDISK_PIO		0	// IDE port I/O
+#define BOOTDISK_DMA		1	// IDE bus master DMA
+#define BOOTDISK_VIRTIO		2	// virtio block device
+
+// Flags (bi_flags)
+#define BOOTFLAG_BSSZERO	0x1	// the loader zeroed every segment's
+					// memory beyond its file contents
+#define BOOTFLAG_WARM		0x2	// reloaded by kexec, not the BIOS
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+// One loaded kernel segment
+struct bootseg {
+	uint32_t bs_pa;		// physical load address
+	uint32_t bs_filesz;	// bytes of initialized data
+	uint32_t bs_memsz;	// bytes of memory the segment occupies
+	uint32_t bs_disksz;	// bytes read from disk (compressed)
+};
+
+struct bootinfo {
+	uint64_t bi_tsc[NBOOTPHASE];		// TSC at each boot phase
+	uint32_t bi_flags;			// BOOTFLAG_*
+	uint32_t bi_disk;			// BOOTDISK_*
+	uint32_t bi_nseg;			// number of segments loaded
+	struct bootseg bi_seg[BOOTINFO_MAXSEG];
+	uint32_t bi_loader;			// the boot loader's text and
+	uint32_t bi_loadersize;			// data: physical address, bytes
+	uint32_t bi_loaderwarm;			// its entry point for kexec
+	uint32_t bi_kimgend;			// first disk sector after the
+						// kernel image
+	struct multiboot_info bi_mbi;		// memory map and sizes
+	struct multiboot_mmap_entry bi_mmap[BOOTINFO_MAXMMAP];
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOTINFO_H */
@@ -13,6 +13,8 @@ enum {
 	E_NO_FREE_ENV	= 5,	// Attempt to create a new environment beyond
 				// the maximum allowed
 	E_FAULT		= 6,	// Memory fault
+	E_NO_DISK	= 7,	// No free space on disk
+	E_IO		= 8,	// Disk I/O error
 
 	MAXERROR
 };
@@ -0,0 +1,42 @@
+#ifndef JOS_INC_IDE_H
+#define JOS_INC_IDE_H
+
+/*
+ * ATA registers and commands, for the boot loader's IDE driver
+ * (boot/ide.c) and the kernel's (kern/ide.c).  Both talk to the
+ * primary channel's command block at 0x1F0-0x1F7.
+ */
+
+#include <inc/types.h>
+
+// Status register (0x1F7, read) bits
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_DRQ		0x08
+#define IDE_ERR		0x01
+
+// Commands (0x1F7, write).  The EXT ones take 48-bit LBAs.
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_READ_EXT	0x24
+#define IDE_CMD_READ_DMA_EXT	0x25
+#define IDE_CMD_READ_MULTIPLE_EXT 0x29
+#define IDE_CMD_WRITE		0x30
+#define IDE_CMD_WRITE_EXT	0x34
+#define IDE_CMD_READ_MULTIPLE	0xC4
+#define IDE_CMD_SET_MULTIPLE	0xC6
+#define IDE_CMD_READ_DMA	0xC8
+#define IDE_CMD_IDENTIFY	0xEC
+
+// Does the disk that answered IDENTIFY with 'id' take 48-bit LBAs?
+// Word 83 bit 10 says it supports them, and word 86 bit 10 that the
+// feature is enabled.  Words 100-103 hold the sectors it can address
+// with them; some disks set the bits but leave those zero.
+static __inline int
+ide_id_lba48(const uint16_t *id)
+{
+	return (id[83] & 0x400) && (id[86] & 0x400)
+		&& (id[100] | id[101] | id[102] | id[103]) != 0;
+}
+
+#endif /* !JOS_INC_IDE_H */
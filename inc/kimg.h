@@ -0,0 +1,43 @@
+#ifndef JOS_INC_KIMG_H
+#define JOS_INC_KIMG_H
+
+/*
+ * The kernel image format the boot loader reads, made from the kernel's
+ * ELF file by boot/mkkimg.  The image starts with a header sector,
+ * struct kimg, indexing each loadable segment; the stored contents of
+ * the segments follow, each starting on a sector boundary so the loader
+ * can read it in one go.  A segment's contents are stored as an LZ4
+ * block (see boot/lz4.c) when that saves sectors, and as is otherwise.
+ *
+ * mkkimg is built for the host, so this header uses only the
+ * fixed-size integer types and leaves it to the includer to define them
+ * (inc/types.h in JOS, <stdint.h> on the host).
+ */
+
+#define KIMG_MAGIC	0x474D494B	// "KIMG"
+
+#define KIMG_HDRSIZE	512		// the header takes up one sector
+#define KIMG_ALIGN	512		// segments start on sector boundaries
+#define KIMG_MAXSEG	8
+
+struct kimg_seg {
+	uint32_t ks_pa;		// physical load address
+	uint32_t ks_filesz;	// bytes of initialized data
+	uint32_t ks_memsz;	// bytes of memory occupied, including BSS
+	uint32_t ks_offset;	// offset of the stored data in the image,
+				// a multiple of KIMG_ALIGN
+	uint32_t ks_size;	// bytes of stored data
+	uint32_t ks_flags;	// KSEG_*
+};
+
+#define KSEG_LZ4	0x1	// stored data is LZ4-compressed
+
+struct kimg {
+	uint32_t ki_magic;	// must equal KIMG_MAGIC
+	uint32_t ki_entry;	// physical address of the entry point
+	uint32_t ki_size;	// bytes in the image, including the header
+	uint32_t ki_nseg;
+	struct kimg_seg ki_seg[KIMG_MAXSEG];
+};
+
+#endif /* !JOS_INC_KIMG_H */
@@ -39,7 +39,9 @@
  *                     |         Kernel Stack         | RW/--  KSTKSIZE   |
  *                     | - - - - - - - - - - - - - - -|                 PTSIZE
  *                     |      Invalid Memory (*)      | --/--             |
- *    ULIM     ------> +------------------------------+ 0xef800000      --+
+ *                     | - - - - - - - - - - - - - - -|                   |
+ *                     |      Temporary Mappings      | RW/--  NKMAP*PGSIZE
+ *    ULIM,KMAPBASE -> +------------------------------+ 0xef800000      --+
  *                     |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
@@ -96,6 +98,11 @@
 #define KSTKSIZE	(8*PGSIZE)   		// size of a kernel stack
 #define ULIM		(KSTACKTOP - PTSIZE) 
 
+// Physical pages that KERNBASE doesn't reach (above 256MB, with PAE)
+// get mapped here for a moment when the kernel needs to touch them.
+#define KMAPBASE	ULIM
+#define NKMAP		8
+
 /*
  * User read-only mappings! Anything below here til UTOP are readonly to user.
  * They are global pages mapped in at env allocation time.
@@ -148,8 +155,14 @@
  * will always be available at virtual address (VPT + (VPT >> PGSHIFT)), to
  * which vpd is set in entry.S.
  */
+#ifndef JOS_PAE
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
+#else
+typedef uint64_t pte_t;
+typedef uint64_t pde_t;
+typedef uint64_t pdpe_t;	// page-directory-pointer table entry
+#endif
 
 extern volatile pte_t vpt[];     // VA of "virtual page table"
 extern volatile pde_t vpd[];     // VA of current page directory
@@ -177,7 +190,41 @@ struct Page {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// Pages are handed out in naturally aligned blocks of 2^pp_order
+	// pages.  These two fields are only meaningful in the first page
+	// of a block, free (PP_FREE) or allocated.
+	uint8_t pp_order;
+	uint8_t pp_flags;
+
+	// A page the kernel heap has made into a slab (PP_SLAB) keeps its
+	// free objects on pp_free, and counts those in use in pp_ref.
+	// The first page of a multi-page heap block keeps its size there,
+	// and a superpage (PP_HUGE) the page table it took the place of.
+	// With PAE, a page directory's first page keeps its
+	// page-directory-pointer table there (see kern/vm.c).
+	void *pp_free;
+	uint8_t pp_class;		// size class, in kern/malloc.c
+
+	// An anonymous page the reclaimer may take back (PP_ANON) records
+	// the one place it's mapped, and the swap slot that has a copy of
+	// it (0 if none; see kern/vm.c).  A page that merged pages share
+	// (PP_KSM) keeps the hash of its contents in pp_va instead.  A
+	// superpage records where it's mapped, too, and a page vm_fork
+	// shared (PP_SHARED) the address every sharer maps it at, and the
+	// address space it was shared from.
+	pde_t *pp_pgdir;
+	uintptr_t pp_va;
+	uint32_t pp_swap;
 };
 
+#define PP_FREE		0x01	// heads a block on a free list
+#define PP_SLAB		0x02	// is a kernel heap slab
+#define PP_ANON		0x04	// is on the reclaimer's list
+#define PP_KSM		0x08	// is shared by merged pages (kern/ksm.c)
+#define PP_HUGE		0x10	// heads a block mapped as one superpage
+#define PP_SHARED	0x20	// is anonymous, but vm_fork shared it
+#define PP_PGDIR	0x40	// heads an address space's page directory
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
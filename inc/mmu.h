@@ -26,16 +26,35 @@
 // To construct a linear address la from PDX(la), PTX(la), and PGOFF(la),
 // use PGADDR(PDX(la), PTX(la), PGOFF(la)).
 
+//
+// With PAE (the kernel built with JOS_PAE), entries are 64 bits, so a
+// page directory or table holds only 512 of them, and a page-directory-
+// pointer table of 4 entries picks one of 4 page directories:
+//
+// +-2-+----9----+----9----+---------12----------+
+// |PDP|   PDX   |   PTX   | Offset within Page  |
+// +---+---------+---------+---------------------+
+//
+// JOS keeps the 4 page directories in consecutive pages and treats them
+// as one 2048-entry page directory, so PDX(la) takes in the PDP bits and
+// everything else works out the same.
+
 // page number field of address
-#define PPN(pa)		(((uintptr_t) (pa)) >> PTXSHIFT)
-#define VPN(la)		PPN(la)		// used to index into vpt[]
+#define PPN(pa)		((ppn_t) (((physaddr_t) (pa)) >> PTXSHIFT))
+#define VPN(la)		(((uintptr_t) (la)) >> PTXSHIFT) // used to index into vpt[]
 
+#ifndef JOS_PAE
 // page directory index
 #define PDX(la)		((((uintptr_t) (la)) >> PDXSHIFT) & 0x3FF)
 #define VPD(la)		PDX(la)		// used to index into vpd[]
 
 // page table index
 #define PTX(la)		((((uintptr_t) (la)) >> PTXSHIFT) & 0x3FF)
+#else
+#define PDX(la)		((((uintptr_t) (la)) >> PDXSHIFT) & 0x7FF)
+#define VPD(la)		PDX(la)
+#define PTX(la)		((((uintptr_t) (la)) >> PTXSHIFT) & 0x1FF)
+#endif
 
 // offset in page
 #define PGOFF(la)	(((uintptr_t) (la)) & 0xFFF)
@@ -44,17 +63,27 @@
 #define PGADDR(d, t, o)	((void*) ((d) << PDXSHIFT | (t) << PTXSHIFT | (o)))
 
 // Page directory and page table constants.
+#ifndef JOS_PAE
 #define NPDENTRIES	1024		// page directory entries per page directory
 #define NPTENTRIES	1024		// page table entries per page table
+#else
+#define NPDENTRIES	2048		// in all 4 page directories
+#define NPTENTRIES	512
+#define NPDPENTRIES	4		// page-directory-pointer table entries
+#endif
 
 #define PGSIZE		4096		// bytes mapped by a page
 #define PGSHIFT		12		// log2(PGSIZE)
 
 #define PTSIZE		(PGSIZE*NPTENTRIES) // bytes mapped by a page directory entry
+#ifndef JOS_PAE
 #define PTSHIFT		22		// log2(PTSIZE)
+#else
+#define PTSHIFT		21
+#endif
 
 #define PTXSHIFT	12		// offset of PTX in a linear address
-#define PDXSHIFT	22		// offset of PDX in a linear address
+#define PDXSHIFT	PTSHIFT		// offset of PDX in a linear address
 
 // Page table/directory entry flags.
 #define PTE_P		0x001	// Present
@@ -74,8 +103,17 @@
 // Only flags in PTE_ALLOWED may be used in system calls.
 #define PTE_ALLOWED	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
+#ifdef JOS_PAE
+// No-execute, if EFER.NXE is on (entry.S turns it on if it can)
+#define PTE_NX		0x8000000000000000ULL
+#endif
+
 // Address in page table or page directory entry
+#ifndef JOS_PAE
 #define PTE_ADDR(pte)	((physaddr_t) (pte) & ~0xFFF)
+#else
+#define PTE_ADDR(pte)	((physaddr_t) ((pte) & 0x000FFFFFFFFFF000ULL))
+#endif
 
 // Control Register flags
 #define CR0_PE		0x00000001	// Protection Enable
@@ -91,13 +129,27 @@
 #define CR0_PG		0x80000000	// Paging
 
 #define CR4_PCE		0x00000100	// Performance counter enable
+#define CR4_PGE		0x00000080	// Page Global Enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
+#define CR4_PAE		0x00000020	// Physical Address Extension
 #define CR4_PSE		0x00000010	// Page Size Extensions
 #define CR4_DE		0x00000008	// Debugging Extensions
 #define CR4_TSD		0x00000004	// Time Stamp Disable
 #define CR4_PVI		0x00000002	// Protected-Mode Virtual Interrupts
 #define CR4_VME		0x00000001	// V86 Mode Extensions
 
+// CPUID function 1 feature flags in %edx
+#define CPUID_FEAT_PSE	0x00000008	// Page Size Extensions
+#define CPUID_FEAT_PGE	0x00002000	// Page Global Enable
+#define CPUID_FEAT_SSE2	0x04000000	// SSE2, including movnti
+
+// CPUID function 0x80000001 feature flags in %edx
+#define CPUID_EXT_NX	0x00100000	// No-execute pages
+
+// Model-specific registers
+#define MSR_EFER	0xC0000080	// Extended Feature Enable Register
+#define EFER_NXE	0x00000800	// No-execute enable
+
 // Eflags register
 #define FL_CF		0x00000001	// Carry Flag
 #define FL_PF		0x00000004	// Parity Flag
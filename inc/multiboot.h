@@ -0,0 +1,67 @@
+#ifndef JOS_INC_MULTIBOOT_H
+#define JOS_INC_MULTIBOOT_H
+
+/*
+ * The Multiboot information structure (Multiboot specification 0.6.96),
+ * which is how a Multiboot loader such as GRUB describes the machine to
+ * the kernel.  Our own boot loader passes the memory map in the same
+ * form, as part of its struct bootinfo (see inc/bootinfo.h).
+ */
+
+// %eax holds this when a Multiboot loader jumps to the kernel
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+// Which fields of struct multiboot_info are valid (mi_flags)
+#define MULTIBOOT_INFO_MEMORY		0x001	// mi_mem_lower, mi_mem_upper
+#define MULTIBOOT_INFO_BOOTDEV		0x002	// mi_boot_device
+#define MULTIBOOT_INFO_CMDLINE		0x004	// mi_cmdline
+#define MULTIBOOT_INFO_MODS		0x008	// mi_mods_*
+#define MULTIBOOT_INFO_MEM_MAP		0x040	// mi_mmap_*
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct multiboot_info {
+	uint32_t mi_flags;		// MULTIBOOT_INFO_*
+	uint32_t mi_mem_lower;		// KB of memory from 0
+	uint32_t mi_mem_upper;		// KB of memory from 1MB
+	uint32_t mi_boot_device;
+	uint32_t mi_cmdline;		// physical address of command line
+	uint32_t mi_mods_count;
+	uint32_t mi_mods_addr;
+	uint32_t mi_syms[4];
+	uint32_t mi_mmap_length;	// bytes of memory map
+	uint32_t mi_mmap_addr;		// physical address of memory map
+	uint32_t mi_drives_length;
+	uint32_t mi_drives_addr;
+	uint32_t mi_config_table;
+	uint32_t mi_boot_loader_name;
+	uint32_t mi_apm_table;
+	uint32_t mi_vbe_control_info;
+	uint32_t mi_vbe_mode_info;
+	uint16_t mi_vbe_mode;
+	uint16_t mi_vbe_interface_seg;
+	uint16_t mi_vbe_interface_off;
+	uint16_t mi_vbe_interface_len;
+};
+
+// One memory map entry, as returned by the BIOS (int 0x15, %eax=0xE820)
+// but preceded by its size, not counting mm_size itself.  Walk the map
+// by adding mm_size + 4 to an entry's address to get the next one.
+struct multiboot_mmap_entry {
+	uint32_t mm_size;
+	uint64_t mm_addr;
+	uint64_t mm_len;
+	uint32_t mm_type;		// MULTIBOOT_MEMORY_*
+} __attribute__((packed));
+
+#define MULTIBOOT_MEMORY_AVAILABLE	1
+#define MULTIBOOT_MEMORY_RESERVED	2
+#define MULTIBOOT_MEMORY_ACPI		3	// ACPI tables, reclaimable
+#define MULTIBOOT_MEMORY_NVS		4	// ACPI non-volatile storage
+#define MULTIBOOT_MEMORY_BADRAM		5
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_MULTIBOOT_H */
@@ -21,10 +21,15 @@ typedef unsigned long long uint64_t;
 // Pointers and addresses are 32 bits long.
 // We use pointer types to represent virtual addresses,
 // uintptr_t to represent the numerical values of virtual addresses,
-// and physaddr_t to represent physical addresses.
+// and physaddr_t to represent physical addresses.  With PAE, physical
+// addresses go past 4GB, so they take 64 bits.
 typedef int32_t intptr_t;
 typedef uint32_t uintptr_t;
+#ifndef JOS_PAE
 typedef uint32_t physaddr_t;
+#else
+typedef uint64_t physaddr_t;
+#endif
 
 // Page numbers are 32 bits long.
 typedef uint32_t ppn_t;
@@ -2,6 +2,7 @@
 #define JOS_INC_X86_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 
 static __inline void breakpoint(void) __attribute__((always_inline));
 static __inline uint8_t inb(int port) __attribute__((always_inline));
@@ -28,6 +29,7 @@ static __inline uint32_t rcr3(void) __attribute__((always_inline));
 static __inline void lcr4(uint32_t val) __attribute__((always_inline));
 static __inline uint32_t rcr4(void) __attribute__((always_inline));
 static __inline void tlbflush(void) __attribute__((always_inline));
+static __inline void tlbflush_global(void) __attribute__((always_inline));
 static __inline uint32_t read_eflags(void) __attribute__((always_inline));
 static __inline void write_eflags(uint32_t eflags) __attribute__((always_inline));
 static __inline uint32_t read_ebp(void) __attribute__((always_inline));
@@ -211,6 +213,8 @@ rcr4(void)
 	return cr4;
 }
 
+// Flush the TLB, except for global (PTE_G) entries, as an address space
+// switch does.  invlpg, in contrast, evicts a page even if it's global.
 static __inline void
 tlbflush(void)
 {
@@ -219,6 +223,19 @@ tlbflush(void)
 	__asm __volatile("movl %0,%%cr3" : : "r" (cr3));
 }
 
+// Flush the whole TLB, global entries included, by toggling CR4.PGE.
+static __inline void
+tlbflush_global(void)
+{
+	uint32_t cr4 = rcr4();
+
+	if (cr4 & CR4_PGE) {
+		lcr4(cr4 & ~CR4_PGE);
+		lcr4(cr4);
+	} else
+		tlbflush();
+}
+
 static __inline uint32_t
 read_eflags(void)
 {
@@ -0,0 +1,98 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/arena.h>
+#include <kern/pmap.h>
+
+/*
+ * An arena is a list of chunks, each a block of pages from the page
+ * allocator, linked through their struct Pages.  The struct Arena
+ * itself lives at the start of the first chunk, which the arena keeps
+ * until it's destroyed.  Allocation bumps a pointer through the newest
+ * chunk; when that's used up, the arena gets another chunk big enough
+ * for the request.
+ */
+
+// Add a chunk of at least 'size' bytes and make it the current one.
+static int
+arena_grow(struct Arena *ar, size_t size)
+{
+	struct Page *pp;
+	int order = 0, r;
+
+	while ((PGSIZE << order) < size)
+		if (++order > PAGE_MAXORDER)
+			return -E_NO_MEM;
+	if ((r = page_alloc_order(&pp, order, 0)) < 0)
+		return r;
+	pp->pp_ref = 1;
+	LIST_INSERT_HEAD(&ar->ar_chunks, pp, pp_link);
+	ar->ar_cur = page2kva(pp);
+	ar->ar_end = ar->ar_cur + (PGSIZE << order);
+	return 0;
+}
+
+// Create an empty arena.  Returns NULL if out of memory.
+struct Arena *
+arena_create(void)
+{
+	struct Arena *ar;
+	struct Page *pp;
+
+	if (page_alloc(&pp, 0) < 0)
+		return NULL;
+	pp->pp_ref = 1;
+	ar = page2kva(pp);
+	LIST_INIT(&ar->ar_chunks);
+	LIST_INSERT_HEAD(&ar->ar_chunks, pp, pp_link);
+	ar->ar_cur = (char *) (ar + 1);
+	ar->ar_end = (char *) ar + PGSIZE;
+	ar->ar_used = 0;
+	return ar;
+}
+
+// Allocate 'size' bytes aligned to 'align', which must be a power of
+// two no bigger than a page.  Returns NULL if out of memory.
+void *
+arena_alloc(struct Arena *ar, size_t size, size_t align)
+{
+	char *p;
+
+	assert(align > 0 && (align & (align - 1)) == 0 && align <= PGSIZE);
+	p = ROUNDUP(ar->ar_cur, align);
+	if (p > ar->ar_end || size > ar->ar_end - p) {
+		if (arena_grow(ar, size) < 0)
+			return NULL;
+		p = ar->ar_cur;		// chunks are page aligned
+	}
+	ar->ar_cur = p + size;
+	ar->ar_used += size;
+	return p;
+}
+
+// Free everything allocated from 'ar', keeping the arena itself.
+void
+arena_reset(struct Arena *ar)
+{
+	struct Page *pp, *first = pa2page(PADDR(ar));
+
+	while ((pp = LIST_FIRST(&ar->ar_chunks)) != first) {
+		LIST_REMOVE(pp, pp_link);
+		page_decref(pp);
+	}
+	ar->ar_cur = (char *) (ar + 1);
+	ar->ar_end = (char *) ar + PGSIZE;
+	ar->ar_used = 0;
+}
+
+// Free 'ar' and everything allocated from it.
+void
+arena_destroy(struct Arena *ar)
+{
+	arena_reset(ar);
+	page_decref(pa2page(PADDR(ar)));
+}
@@ -0,0 +1,27 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_ARENA_H
+#define JOS_KERN_ARENA_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// A bump-pointer allocator for a burst of objects that all die at once.
+// Objects can't be freed one by one; arena_reset or arena_destroy gives
+// back everything allocated from the arena in one step.
+struct Arena {
+	struct Page_list ar_chunks;	// pages the arena holds
+	char *ar_cur;			// next free byte in the current chunk
+	char *ar_end;			// end of the current chunk
+	size_t ar_used;			// bytes handed out since the last reset
+};
+
+struct Arena *arena_create(void);
+void *arena_alloc(struct Arena *ar, size_t size, size_t align);
+void arena_reset(struct Arena *ar);
+void arena_destroy(struct Arena *ar);
+
+#endif	// !JOS_KERN_ARENA_H
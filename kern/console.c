@@ -7,6 +7,8 @@
 #include <inc/assert.h>
 
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/ksm.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -75,6 +77,20 @@ serial_putc(int c)
 	outb(COM1 + COM_TX, c);
 }
 
+// Wait for the UART to finish sending what it has, then turn off its
+// interrupts, so the next kernel finds it idle.
+static void
+serial_quiesce(void)
+{
+	int i;
+
+	if (!serial_exists)
+		return;
+	for (i = 0; !(inb(COM1 + COM_LSR) & COM_LSR_TSRE) && i < 12800; i++)
+		delay();
+	outb(COM1+COM_IER, 0);
+}
+
 static void
 serial_init(void)
 {
@@ -445,6 +461,13 @@ cons_init(void)
 		cprintf("Serial port does not exist!\n");
 }
 
+// quiesce the console devices before handing the machine to a new kernel
+void
+cons_quiesce(void)
+{
+	serial_quiesce();
+}
+
 
 // `High'-level console I/O.  Used by readline and cprintf.
 
@@ -459,8 +482,11 @@ getchar(void)
 {
 	int c;
 
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	// Waiting for a key is our idle loop.
+	while ((c = cons_getc()) == 0) {
+		page_zero_idle();
+		ksm_idle();
+	}
 	return c;
 }
 
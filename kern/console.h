@@ -18,6 +18,7 @@
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
 void cons_init(void);
+void cons_quiesce(void);
 int cons_getc(void);
 
 void kbd_intr(void); // irq 1
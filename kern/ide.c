@@ -0,0 +1,113 @@
+/* See COPYRIGHT for copyright information. */
+
+/*
+ * Minimal PIO-based (non-interrupt-driven) driver for the primary IDE
+ * disk, the one the boot loader loads the kernel from.  It only needs
+ * to be simple: the kernel uses it for swap (kern/swap.c).  Disks that
+ * support 48-bit LBA get the EXT commands, so swap can sit past 128GB.
+ */
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/ide.h>
+
+#include <kern/ide.h>
+
+// Nonzero if the disk supports 48-bit LBA; ide_nsect finds out.
+static bool lba48;
+
+static int
+ide_wait_ready(bool check_error)
+{
+	int r;
+
+	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
+		return -E_IO;
+	return 0;
+}
+
+static void
+ide_command(uint8_t cmd, uint32_t secno, size_t nsecs)
+{
+	ide_wait_ready(0);
+	if (lba48) {
+		// Each register takes two bytes in a row, high-order first.
+		// Our sector numbers fit in 32 bits, so LBA bits 32-47 are 0.
+		outb(0x1F2, nsecs >> 8);
+		outb(0x1F3, secno >> 24);
+		outb(0x1F4, 0);
+		outb(0x1F5, 0);
+		outb(0x1F2, nsecs);
+		outb(0x1F3, secno & 0xFF);
+		outb(0x1F4, (secno >> 8) & 0xFF);
+		outb(0x1F5, (secno >> 16) & 0xFF);
+		outb(0x1F6, 0x40);
+	} else {
+		outb(0x1F2, nsecs);		// 256 is sent as 0
+		outb(0x1F3, secno & 0xFF);
+		outb(0x1F4, (secno >> 8) & 0xFF);
+		outb(0x1F5, (secno >> 16) & 0xFF);
+		outb(0x1F6, 0xE0 | ((secno >> 24) & 0x0F));
+	}
+	outb(0x1F7, cmd);
+}
+
+// Number of sectors on the disk we can reach, or 0 if the disk doesn't
+// answer IDENTIFY.  Call this before reading or writing: it's what
+// picks 28- or 48-bit LBA.
+uint32_t
+ide_nsect(void)
+{
+	uint16_t id[256];
+
+	if (inb(0x1F7) == 0xFF)		// floating bus: no controller
+		return 0;
+	lba48 = 0;
+	ide_command(IDE_CMD_IDENTIFY, 0, 0);
+	if (ide_wait_ready(1) < 0 || !(inb(0x1F7) & IDE_DRQ))
+		return 0;
+	insl(0x1F0, id, sizeof(id) / 4);
+	if ((lba48 = ide_id_lba48(id))) {
+		// Words 100-103: sectors addressable with 48-bit LBA, as
+		// many as 32-bit sector numbers reach
+		if (id[102] || id[103])
+			return ~0U;
+		return id[100] | (id[101] << 16);
+	}
+	// Words 60-61: sectors addressable with 28-bit LBA
+	return id[60] | (id[61] << 16);
+}
+
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	assert(nsecs > 0 && nsecs <= 256);
+	ide_command(lba48 ? IDE_CMD_READ_EXT : IDE_CMD_READ, secno, nsecs);
+	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
+	return 0;
+}
+
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	assert(nsecs > 0 && nsecs <= 256);
+	ide_command(lba48 ? IDE_CMD_WRITE_EXT : IDE_CMD_WRITE, secno, nsecs);
+	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		outsl(0x1F0, src, SECTSIZE/4);
+	}
+	// Wait for the last sector to make it to the disk.
+	return ide_wait_ready(1);
+}
@@ -0,0 +1,17 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define SECTSIZE	512		// bytes per disk sector
+
+uint32_t ide_nsect(void);
+int ide_read(uint32_t secno, void *dst, size_t nsecs);
+int ide_write(uint32_t secno, const void *src, size_t nsecs);
+
+#endif	// !JOS_KERN_IDE_H
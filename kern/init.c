@@ -3,9 +3,20 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/init.h>
+#include <kern/pmap.h>
+#include <kern/malloc.h>
+#include <kern/kexec.h>
+#include <kern/vm.h>
+#include <kern/ksm.h>
+
+struct bootinfo *bootinfo;
+static struct bootinfo bootinfo_copy;
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -20,20 +31,54 @@ test_backtrace(int x)
 }
 
 void
-i386_init(void)
+i386_init(uint32_t boot_magic, uint32_t boot_info)
 {
 	extern char edata[], end[];
+	struct bootinfo *bi = NULL;
+	struct multiboot_info *mbi = NULL;
    	// Lab1 only
 	char chnum1 = 0, chnum2 = 0, ntest[256] = {};
 
+	if (boot_magic == BOOTINFO_MAGIC) {
+		bi = (struct bootinfo *) (KERNBASE + boot_info);
+		bi->bi_tsc[BOOTPHASE_INIT] = read_tsc();
+	} else if (boot_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+		mbi = (struct multiboot_info *) (KERNBASE + boot_info);
+
 	// Before doing anything else, complete the ELF loading process.
-	// Clear the uninitialized global data (BSS) section of our program.
+	// Clear the uninitialized global data (BSS) section of our program,
+	// unless the boot loader already did it for us.
 	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	if (!bi || !(bi->bi_flags & BOOTFLAG_BSSZERO))
+		memset(edata, 0, end - edata);
+	if (bi)
+		bi->bi_tsc[BOOTPHASE_BSS] = read_tsc();
+
+	// Keep our own copy of the boot loader's bootinfo, since the
+	// memory it lives in is not reserved for it.
+	if (bi) {
+		bootinfo_copy = *bi;
+		bootinfo = &bootinfo_copy;
+		mbi = &bootinfo->bi_mbi;
+		mbi->mi_mmap_addr = PADDR(bootinfo->bi_mmap);
+	}
+	kexec_init();
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	if (bootinfo)
+		bootinfo->bi_tsc[BOOTPHASE_CONS] = read_tsc();
+
+	// Find out how much memory the machine has, and hand it
+	// to the page allocator.
+	i386_detect_memory(mbi);
+	page_init();
+	check_malloc();
+	vm_init();
+	check_vm();
+	check_ksm();
+	vm_stat_reset();
 
 	cprintf("6828 decimal is %o octal!%n\n%n", 6828, &chnum1, &chnum2);
 	cprintf("pading space in the right to number 22: %-8d.\n", 22);
@@ -48,6 +93,8 @@ i386_init(void)
 	test_backtrace(5);
 
 	// Drop into the kernel monitor.
+	if (bootinfo)
+		bootinfo->bi_tsc[BOOTPHASE_MONITOR] = read_tsc();
 	while (1)
 		monitor(NULL);
 }
@@ -0,0 +1,15 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_INIT_H
+#define JOS_KERN_INIT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/bootinfo.h>
+
+// What the boot loader told us about how it loaded the kernel,
+// or NULL if we were loaded by something other than boot/.
+extern struct bootinfo *bootinfo;
+
+#endif	// !JOS_KERN_INIT_H
@@ -0,0 +1,82 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/kexec.h>
+#include <kern/init.h>
+#include <kern/console.h>
+#include <kern/pmap.h>
+
+/*
+ * kexec reloads the kernel from the boot disk without going back
+ * through the BIOS.  It does so by running boot stage 2 again: stage 2
+ * already knows how to find, read and unpack the kernel image on any
+ * disk it supports, and hand over a fresh bootinfo.
+ *
+ * Low memory isn't ours to keep the boot loader in, so kexec_init takes
+ * a copy of its text and data at boot.  kexec then turns off paging,
+ * puts the copy back, and enters stage 2 at its warm entry point
+ * (kexecentry.S).
+ */
+
+// The loader's text and data fit in stage 1's sector plus the
+// BOOT2_NSECT sectors boot/Makefrag gives stage 2: all that's before
+// the kernel image (KERNSECT in boot/boot.h).
+#define LOADER_MAXSIZE	((1 + BOOT2_NSECT) * 512)
+
+static uint8_t loader_copy[LOADER_MAXSIZE];
+static size_t loader_size;	// 0 if we have no copy
+
+// Save a copy of the boot loader.  Call before anything can have
+// reused the low memory it's in.
+void
+kexec_init(void)
+{
+	if (!bootinfo || bootinfo->bi_loadersize == 0)
+		return;
+	if (bootinfo->bi_loadersize > sizeof(loader_copy))
+		panic("kexec_init: boot loader is %d bytes, room for %d",
+		      bootinfo->bi_loadersize, sizeof(loader_copy));
+	memmove(loader_copy, (void *) (KERNBASE + bootinfo->bi_loader),
+		bootinfo->bi_loadersize);
+	loader_size = bootinfo->bi_loadersize;
+}
+
+// Reload the kernel from disk.  Returns only if that's impossible,
+// because we weren't loaded by our own boot loader.
+int
+kexec(void)
+{
+	extern char kexec_tramp[];
+#ifndef JOS_PAE
+	extern pde_t entry_pgdir[];
+#else
+	extern pdpe_t entry_pdpt[];
+#endif
+
+	if (loader_size == 0)
+		return -E_INVAL;
+
+	cons_quiesce();
+	__asm __volatile("cli");
+
+	// The trampoline runs at its physical address, which entry_pgdir
+	// maps to itself (with PAE too), so it keeps running when it turns paging off.
+	// Leave the new kernel no global pages.
+#ifndef JOS_PAE
+	lcr3(PADDR(entry_pgdir));
+#else
+	lcr3(PADDR(entry_pdpt));
+#endif
+	lcr4(rcr4() & ~CR4_PGE);
+	__asm __volatile("jmp *%0" : :
+			 "a" ((uint32_t) PADDR(kexec_tramp)),
+			 "S" ((uint32_t) PADDR(loader_copy)),
+			 "D" (bootinfo->bi_loader), "c" (loader_size),
+			 "d" (bootinfo->bi_loaderwarm));
+	panic("kexec: trampoline returned");
+}
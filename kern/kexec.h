@@ -0,0 +1,12 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KEXEC_H
+#define JOS_KERN_KEXEC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+void kexec_init(void);
+int kexec(void);
+
+#endif	// !JOS_KERN_KEXEC_H
@@ -0,0 +1,253 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/ksm.h>
+#include <kern/pmap.h>
+#include <kern/vm.h>
+
+/*
+ * Same-page merging.  Anonymous pages with the same contents (zeroes,
+ * more often than not) don't need a copy each: they can all map one
+ * page read-only, and vm_fault gives a mapping its own copy when it
+ * writes (PTE_COW).
+ *
+ * While the kernel is idle, ksm_scan walks the anonymous pages on the
+ * reclaim list and hashes each one's contents.  A page that matches a
+ * shared page (PP_KSM) in the stable table gets merged into it.  A page
+ * that matches the page last seen with the same hash, in the unstable
+ * table, makes that page shared, and gets merged into it.  Hashes only
+ * pick candidates; pages are merged only if their contents compare
+ * equal.
+ *
+ * Entries in the unstable table are not kept up to date: a page there
+ * may have been freed or reused since.  That's fine as long as it's
+ * still an anonymous page with the same contents, and we check.
+ */
+
+#define KSM_NHASH	1024
+#define KSM_INTERVAL	10000000	// cycles between idle scans
+
+uint32_t ksm_rate = 32;
+
+static struct Page_list ksm_stable[KSM_NHASH];	// shared pages, by hash
+static struct Page *ksm_unstable[KSM_NHASH];	// a page seen, by hash
+static struct Page *ksm_hand;	// next page to scan, or NULL
+static uint64_t ksm_last;	// TSC at the last idle scan
+
+// Statistics, for ksmstat
+static uint32_t ksm_nscan;	// pages scanned
+static uint32_t ksm_nmerge;	// pages merged into shared ones
+
+// FNV-1a, a word at a time
+static uint32_t
+page_hash(struct Page *pp)
+{
+	const uint32_t *p = kmap(pp);
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < PGSIZE / 4; i++)
+		h = (h ^ p[i]) * 16777619;
+	kunmap((void *) p);
+	return h;
+}
+
+static bool
+page_same(struct Page *a, struct Page *b)
+{
+	void *va = kmap(a), *vb = kmap(b);
+	bool same = memcmp(va, vb, PGSIZE) == 0;
+
+	kunmap(vb);
+	kunmap(va);
+	return same;
+}
+
+// Turn the anonymous page 'pp', mapped by '*pte', into a shared page
+// with hash 'h'.  It stays mapped, but copy-on-write.
+static void
+ksm_share(struct Page *pp, pte_t *pte, uint32_t h)
+{
+	if (*pte & PTE_W)
+		*pte = (*pte & ~PTE_W) | PTE_COW;
+	tlb_invalidate(pp->pp_pgdir, (void *) pp->pp_va);
+	vm_page_forget(pp);
+	pp->pp_flags |= PP_KSM;
+	pp->pp_va = h;
+	LIST_INSERT_HEAD(&ksm_stable[h % KSM_NHASH], pp, pp_link);
+}
+
+// Point the mapping '*pte' of the anonymous page 'pp' at the shared
+// page 'shared' instead, and free 'pp'.
+static void
+ksm_merge(struct Page *pp, pte_t *pte, struct Page *shared)
+{
+	pte_t perm = *pte & PTE_U;
+
+	if (*pte & PTE_W)
+		perm |= PTE_COW;
+	shared->pp_ref++;
+	*pte = page2pa(shared) | perm | PTE_P;
+	tlb_invalidate(pp->pp_pgdir, (void *) pp->pp_va);
+	page_decref(pp);
+	ksm_nmerge++;
+}
+
+// Scan up to 'npages' anonymous pages for ones to merge, picking up
+// where the last scan left off.  Returns the number scanned.
+int
+ksm_scan(int npages)
+{
+	struct Page *pp, *q, **u;
+	pte_t *pte;
+	uint32_t h;
+	int n;
+
+	for (n = 0; n < npages; n++) {
+		if (ksm_hand == NULL && (ksm_hand = vm_anon_first()) == NULL)
+			break;
+		pp = ksm_hand;
+		ksm_hand = LIST_NEXT(pp, pp_link);
+		ksm_nscan++;
+
+		h = page_hash(pp);
+		pte = pgdir_walk(pp->pp_pgdir, (void *) pp->pp_va, 0);
+		LIST_FOREACH(q, &ksm_stable[h % KSM_NHASH], pp_link)
+			if (q->pp_va == h && page_same(q, pp))
+				break;
+		if (q) {
+			ksm_merge(pp, pte, q);
+			continue;
+		}
+
+		u = &ksm_unstable[h % KSM_NHASH];
+		if (*u && *u != pp && ((*u)->pp_flags & PP_ANON)
+		    && page_same(*u, pp)) {
+			q = *u;
+			*u = NULL;
+			ksm_share(q, pgdir_walk(q->pp_pgdir, (void *) q->pp_va, 0), h);
+			ksm_merge(pp, pte, q);
+		} else
+			*u = pp;
+	}
+	return n;
+}
+
+// Called from the idle loop: scan ksm_rate pages every KSM_INTERVAL
+// cycles.
+void
+ksm_idle(void)
+{
+	uint64_t now;
+
+	if (ksm_rate == 0 || (now = read_tsc()) - ksm_last < KSM_INTERVAL)
+		return;
+	ksm_last = now;
+	ksm_scan(ksm_rate);
+}
+
+// 'pp' is going away; forget about it.
+void
+ksm_forget(struct Page *pp)
+{
+	if (ksm_hand == pp)
+		ksm_hand = LIST_NEXT(pp, pp_link);
+	if (pp->pp_flags & PP_KSM) {
+		LIST_REMOVE(pp, pp_link);
+		pp->pp_flags &= ~PP_KSM;
+	}
+}
+
+void
+ksm_stat(void)
+{
+	struct Page *pp;
+	uint32_t nshared = 0, nsaved = 0;
+	int i;
+
+	for (i = 0; i < KSM_NHASH; i++)
+		LIST_FOREACH(pp, &ksm_stable[i], pp_link) {
+			nshared++;
+			nsaved += pp->pp_ref - 1;
+		}
+	cprintf("%d shared pages stand in for %d: %dK saved\n",
+		nshared, nshared + nsaved, nsaved * PGSIZE / 1024);
+	cprintf("%d pages scanned, %d merged; scanning %d pages per %d cycles\n",
+		ksm_nscan, ksm_nmerge, ksm_rate, KSM_INTERVAL);
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+// Fill the page at 'va' with 'c', through kmap.
+static void
+check_memset(pde_t *pgdir, uintptr_t va, int c)
+{
+	void *p = kmap(page_lookup(pgdir, (void *) va, NULL));
+
+	memset(p, c, PGSIZE);
+	kunmap(p);
+}
+
+// Check that two anonymous pages with the same contents get merged
+// into one shared page, and that a write unshares them again.
+void
+check_ksm(void)
+{
+	uint32_t nscan0 = ksm_nscan, nmerge0 = ksm_nmerge;
+	size_t nfree0 = page_nfree();
+	uintptr_t va0 = UTEXT, va1 = UTEXT + PGSIZE;
+	struct Page *pp, *pp1;
+	pte_t *pte0, *pte1;
+	pde_t *pgdir;
+
+	assert(vm_pgdir_alloc(&pgdir) == 0);
+	assert(vm_map_anon(pgdir, va0, 2 * PGSIZE, PTE_W|PTE_U) == 0);
+	assert(vm_fault(pgdir, va0, FEC_U|FEC_WR) == 0);
+	if (!page_lookup(pgdir, (void *) va1, NULL))
+		assert(vm_fault(pgdir, va1, FEC_U|FEC_WR) == 0);
+	check_memset(pgdir, va0, 0x5a);
+	check_memset(pgdir, va1, 0x5a);
+	pte0 = pgdir_walk(pgdir, (void *) va0, 0);
+	pte1 = pgdir_walk(pgdir, (void *) va1, 0);
+	assert(PTE_ADDR(*pte0) != PTE_ADDR(*pte1));
+
+	// one scan of both merges them, copy-on-write
+	ksm_scan(4);
+	assert(ksm_nscan >= nscan0 + 2);
+	assert(ksm_nmerge == nmerge0 + 1);
+	assert(PTE_ADDR(*pte0) == PTE_ADDR(*pte1));
+	assert((*pte0 & (PTE_P|PTE_W|PTE_COW)) == (PTE_P|PTE_COW));
+	assert((*pte1 & (PTE_P|PTE_W|PTE_COW)) == (PTE_P|PTE_COW));
+	pp = page_lookup(pgdir, (void *) va0, NULL);
+	assert((pp->pp_flags & (PP_KSM|PP_ANON)) == PP_KSM);
+	assert(pp->pp_ref == 2);
+
+	// writing through one mapping gives it a copy of its own
+	assert(vm_fault(pgdir, va1, FEC_U|FEC_WR) == 0);
+	pp1 = page_lookup(pgdir, (void *) va1, NULL);
+	assert(pp1 != pp && (pp1->pp_flags & PP_ANON));
+	assert((*pte1 & (PTE_P|PTE_W|PTE_COW)) == (PTE_P|PTE_W));
+	assert(page_same(pp, pp1));
+	assert(pp->pp_ref == 1 && (pp->pp_flags & PP_KSM));
+	assert(*pte0 & PTE_COW);
+
+	// ... and the last one left just gets to write
+	assert(vm_fault(pgdir, va0, FEC_U|FEC_WR) == 0);
+	assert(page_lookup(pgdir, (void *) va0, NULL) == pp);
+	assert((pp->pp_flags & (PP_KSM|PP_ANON)) == PP_ANON);
+	assert((*pte0 & (PTE_P|PTE_W|PTE_COW)) == (PTE_P|PTE_W));
+
+	vm_pgdir_free(pgdir);
+	assert(page_nfree() == nfree0);
+	ksm_nscan = nscan0;
+	ksm_nmerge = nmerge0;
+	cprintf("check_ksm() succeeded!\n");
+}
@@ -0,0 +1,20 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KSM_H
+#define JOS_KERN_KSM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+
+// Pages ksm_idle scans each time it runs; 0 turns the scanner off.
+extern uint32_t ksm_rate;
+
+void ksm_idle(void);
+int ksm_scan(int npages);
+void ksm_forget(struct Page *pp);
+void ksm_stat(void);
+void check_ksm(void);
+
+#endif	// !JOS_KERN_KSM_H
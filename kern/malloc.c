@@ -0,0 +1,294 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/malloc.h>
+#include <kern/pmap.h>
+
+/*
+ * The kernel heap.
+ *
+ * Small requests come out of slabs: pages cut into equal objects of one
+ * size class.  The classes are the powers of two from 16 to 2048 bytes
+ * and the 3*2^k sizes in between (24, 48, ... 1536), so no object is
+ * more than a third bigger than what was asked for.  A slab keeps its
+ * free objects on a list threaded through the objects themselves, with
+ * the head and the count in use in the slab's struct Page, so there is
+ * no header in the page and malloc and free are a few loads and stores.
+ *
+ * Each class keeps the slabs that have a free object on a list; full
+ * slabs are on no list.  A slab that empties goes back to the page
+ * allocator unless it's the class's last one.
+ *
+ * Anything bigger than the largest class gets a block of whole pages
+ * of its own from page_alloc_order.
+ */
+
+#define MINSHIFT	4			// smallest class is 16 bytes
+#define MAXSHIFT	11			// largest is 2048
+#define NCLASS		(2 * (MAXSHIFT - MINSHIFT) + 1)
+
+struct kmem_class {
+	uint32_t kc_size;		// object size
+	uint32_t kc_nobj;		// objects per slab
+	struct Page_list kc_partial;	// slabs with free objects
+	uint32_t kc_nslab;		// slabs, full or not
+	uint32_t kc_inuse;		// objects handed out
+};
+
+static struct kmem_class kmem_class[NCLASS];
+
+// Pages in multi-page allocations, and the bytes asked for in them
+static size_t large_npage, large_bytes;
+
+// Size class index for a request of 'size' bytes (1 <= size <= 2048).
+// A size in (2^k, 2^(k+1)] fits the 3*2^(k-1) class if it's no bigger.
+static int
+size2class(size_t size)
+{
+	int k;
+
+	if (size <= (1 << MINSHIFT))
+		return 0;
+	k = 31 - __builtin_clz(size - 1);
+	if (size <= (3 << (k - 1)))
+		return 2 * (k - MINSHIFT) + 1;
+	return 2 * (k - MINSHIFT + 1);
+}
+
+static struct kmem_class *
+class_get(int c)
+{
+	struct kmem_class *kc = &kmem_class[c];
+
+	if (kc->kc_size == 0) {
+		kc->kc_size = c & 1 ? 3 << (MINSHIFT + c / 2 - 1)
+			: 1 << (MINSHIFT + c / 2);
+		kc->kc_nobj = PGSIZE / kc->kc_size;
+	}
+	return kc;
+}
+
+// Make a new slab for class 'c' and put it on the class's list.
+static struct Page *
+slab_new(int c)
+{
+	struct kmem_class *kc = class_get(c);
+	struct Page *pp;
+	char *obj;
+	int i;
+
+	if (page_alloc(&pp, 0) < 0)
+		return NULL;
+	pp->pp_flags |= PP_SLAB;
+	pp->pp_class = c;
+	pp->pp_ref = 0;
+
+	// Thread the free list through the objects in address order.
+	obj = page2kva(pp);
+	pp->pp_free = obj;
+	for (i = 0; i < kc->kc_nobj - 1; i++, obj += kc->kc_size)
+		*(void **) obj = obj + kc->kc_size;
+	*(void **) obj = NULL;
+
+	LIST_INSERT_HEAD(&kc->kc_partial, pp, pp_link);
+	kc->kc_nslab++;
+	return pp;
+}
+
+static void *
+large_alloc(size_t size)
+{
+	struct Page *pp;
+	size_t npg = ROUNDUP(size, PGSIZE) / PGSIZE;
+	int order = 0;
+
+	while ((1 << order) < npg)
+		if (++order > PAGE_MAXORDER)
+			return NULL;
+	if (page_alloc_order(&pp, order, 0) < 0)
+		return NULL;
+	pp->pp_ref = 1;
+	large_npage += 1 << order;
+	large_bytes += size;
+	pp->pp_free = (void *) size;	// for malloc_stat
+	return page2kva(pp);
+}
+
+void *
+malloc(size_t size)
+{
+	struct kmem_class *kc;
+	struct Page *pp;
+	void *obj;
+	int c;
+
+	if (size == 0)
+		return NULL;
+	if (size > (1 << MAXSHIFT))
+		return large_alloc(size);
+
+	c = size2class(size);
+	kc = class_get(c);
+	if ((pp = LIST_FIRST(&kc->kc_partial)) == NULL
+	    && (pp = slab_new(c)) == NULL)
+		return NULL;
+
+	obj = pp->pp_free;
+	pp->pp_free = *(void **) obj;
+	pp->pp_ref++;
+	kc->kc_inuse++;
+	if (pp->pp_free == NULL)
+		LIST_REMOVE(pp, pp_link);
+	return obj;
+}
+
+void
+free(void *addr)
+{
+	struct kmem_class *kc;
+	struct Page *pp;
+
+	if (addr == NULL)
+		return;
+	pp = pa2page(PADDR(addr));
+
+	if (!(pp->pp_flags & PP_SLAB)) {
+		if (PGOFF(addr) || pp->pp_ref != 1)
+			panic("free: %08x was not malloc'ed", addr);
+		large_npage -= 1 << pp->pp_order;
+		large_bytes -= (size_t) pp->pp_free;
+		pp->pp_free = NULL;
+		page_decref(pp);
+		return;
+	}
+
+	kc = &kmem_class[pp->pp_class];
+	if ((uintptr_t) PGOFF(addr) % kc->kc_size)
+		panic("free: %08x is not a %d-byte object", addr, kc->kc_size);
+	if (pp->pp_free == NULL)
+		LIST_INSERT_HEAD(&kc->kc_partial, pp, pp_link);
+	*(void **) addr = pp->pp_free;
+	pp->pp_free = addr;
+	pp->pp_ref--;
+	kc->kc_inuse--;
+
+	// Give an empty slab back, unless it's the only one we'd have.
+	if (pp->pp_ref == 0 && (LIST_NEXT(pp, pp_link) != NULL
+				|| LIST_FIRST(&kc->kc_partial) != pp)) {
+		LIST_REMOVE(pp, pp_link);
+		pp->pp_flags &= ~PP_SLAB;
+		pp->pp_free = NULL;
+		kc->kc_nslab--;
+		page_free(pp);
+	}
+}
+
+// Print each size class's use of its slabs, and how much of the memory
+// the heap holds is not handed out.
+void
+malloc_stat(void)
+{
+	struct kmem_class *kc;
+	size_t held = 0, used = 0;
+	int c;
+
+	cprintf("%6s %6s %8s %8s %6s\n", "size", "slabs", "inuse", "free", "frag");
+	for (c = 0; c < NCLASS; c++) {
+		kc = &kmem_class[c];
+		if (kc->kc_nslab == 0)
+			continue;
+		cprintf("%6d %6d %8d %8d %5d%%\n", kc->kc_size, kc->kc_nslab,
+			kc->kc_inuse, kc->kc_nslab * kc->kc_nobj - kc->kc_inuse,
+			100 - kc->kc_inuse * kc->kc_size * 100
+			/ (kc->kc_nslab * PGSIZE));
+		held += kc->kc_nslab * PGSIZE;
+		used += kc->kc_inuse * kc->kc_size;
+	}
+	if (large_npage) {
+		cprintf("%6s %6d %8d %8s %5d%%\n", "large", large_npage,
+			large_bytes, "",
+			100 - large_bytes * 100 / (large_npage * PGSIZE));
+		held += large_npage * PGSIZE;
+		used += large_bytes;
+	}
+	cprintf("heap: %dK in use of %dK held", used / 1024, held / 1024);
+	if (held)
+		cprintf(", %d%% fragmentation", 100 - used * 100 / held);
+	cprintf("; %d pages free\n", page_nfree());
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+// Check every size class, the large allocation path, reusing a freed
+// object, and giving back slabs that empty.  Runs before anything else
+// uses the heap, so each class starts out with no slabs.
+void
+check_malloc(void)
+{
+	size_t nfree0 = page_nfree(), nlarge0 = large_npage;
+	struct kmem_class *kc;
+	struct Page *pp;
+	char *p, *q, *objs[3];
+	uint32_t size, nslab = 0;
+	int c, i;
+
+	assert(malloc(0) == NULL);
+	for (c = 0; c < NCLASS; c++) {
+		kc = class_get(c);
+		size = kc->kc_size;
+		assert(kc->kc_nslab == 0 && kc->kc_inuse == 0);
+		// the largest and smallest sizes that fit come here
+		assert(size2class(size) == c);
+		assert(c == 0 || size2class(kmem_class[c - 1].kc_size + 1) == c);
+
+		assert((p = malloc(size)) != NULL);
+		pp = pa2page(PADDR(p));
+		assert((pp->pp_flags & PP_SLAB) && pp->pp_class == c);
+		assert(PGOFF(p) % size == 0);
+		assert(kc->kc_nslab == 1 && kc->kc_inuse == 1);
+		memset(p, 0xa5, size);
+
+		// a freed object is the next one handed out
+		free(p);
+		assert(kc->kc_inuse == 0 && kc->kc_nslab == 1);
+		assert((q = malloc(size)) == p);
+		free(q);
+	}
+
+	// Two slabs' worth of 2048-byte objects, and one more: when the
+	// first two slabs empty, one goes back and the last one stays.
+	kc = &kmem_class[NCLASS - 1];
+	assert(kc->kc_nobj == 2);
+	for (i = 0; i < 3; i++)
+		assert((objs[i] = malloc(2048)) != NULL);
+	assert(kc->kc_nslab == 2);
+	assert(pa2page(PADDR(objs[0])) == pa2page(PADDR(objs[1])));
+	for (i = 0; i < 3; i++)
+		free(objs[i]);
+	assert(kc->kc_nslab == 1 && kc->kc_inuse == 0);
+	for (c = 0; c < NCLASS; c++)
+		nslab += kmem_class[c].kc_nslab;
+	assert(nslab == NCLASS && page_nfree() == nfree0 - NCLASS);
+
+	// bigger requests get a block of their own, rounded up to a power
+	// of two pages, or nothing if that's more than the largest block
+	assert((p = malloc(3 * PGSIZE)) != NULL);
+	pp = pa2page(PADDR(p));
+	assert(PGOFF(p) == 0 && !(pp->pp_flags & PP_SLAB));
+	assert(pp->pp_order == 2 && large_npage == nlarge0 + 4);
+	memset(p, 0xa5, 3 * PGSIZE);
+	free(p);
+	assert(large_npage == nlarge0);
+	assert(malloc((PGSIZE << PAGE_MAXORDER) + 1) == NULL);
+	assert(page_nfree() == nfree0 - NCLASS);
+
+	cprintf("check_malloc() succeeded!\n");
+}
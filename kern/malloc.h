@@ -0,0 +1,15 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_MALLOC_H
+#define JOS_KERN_MALLOC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/malloc.h>
+
+void malloc_stat(void);
+void check_malloc(void);
+
+#endif	// !JOS_KERN_MALLOC_H
@@ -6,10 +6,20 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/init.h>
+#include <kern/kexec.h>
+#include <kern/malloc.h>
+#include <kern/arena.h>
+#include <kern/vm.h>
+#include <kern/ksm.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 #define WHITESPACE "\t\r\n "
@@ -27,9 +37,30 @@ static struct Command commands[] = {
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "backtrace", "Print backtrace", mon_backtrace },
 	{ "time", "time cycles", mon_time },
+	{ "boottime", "Display the cycles spent in each boot phase", mon_boottime },
+	{ "kexec", "Reload the kernel from disk without a reset", mon_kexec },
+	{ "heapstat", "Display kernel heap usage by size class", mon_heapstat },
+	{ "vmstat", "Display paging statistics; 'vmstat N' makes superpages at N pages in", mon_vmstat },
+	{ "ksmstat", "Display memory saved by merging identical pages", mon_ksmstat },
+	{ "ksmrate", "Set how many pages each merge scan looks at (0 is off)", mon_ksmrate },
+	{ "pfbench", "Time the kernel's side of user page fault upcalls", mon_pfbench },
+	{ "tlbstat", "Display TLB flushes; 'tlbstat N' flushes all above N pages", mon_tlbstat },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
+// Scratch memory for the command being run, freed when it returns.
+// NULL if there was no memory for it.
+static struct Arena *cmd_arena;
+
+// The arena for the monitor command being run, or NULL if there's none:
+// no memory, or not called from a command.  Whatever a command allocates
+// from it is freed in one step when the command returns.
+struct Arena *
+monitor_arena(void)
+{
+	return cmd_arena;
+}
+
 unsigned read_eip();
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -67,6 +98,150 @@ int mon_time(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+static const char *bootphase_name[NBOOTPHASE] = {
+	[BOOTPHASE_STAGE1] =	"BIOS",
+	[BOOTPHASE_STAGE2] =	"boot stage 1",
+	[BOOTPHASE_LOAD] =	"boot stage 2, disk setup",
+	[BOOTPHASE_UNPACK] =	"kernel image read",
+	[BOOTPHASE_KERNEL] =	"kernel image unpacked",
+	[BOOTPHASE_PAGING] =	"entry.S paging setup",
+	[BOOTPHASE_INIT] =	"entry.S to i386_init",
+	[BOOTPHASE_BSS] =	"BSS clear",
+	[BOOTPHASE_CONS] =	"kexec_init, cons_init",
+	[BOOTPHASE_MONITOR] =	"i386_init to monitor",
+};
+
+// Each phase is named for the work that ends at its stamp, and is shown
+// with the TSC at that stamp and the cycles since the one before.
+// Phases without a stamp (older boot loaders) are skipped.
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	uint64_t start = 0, prev;
+	int i;
+
+	if (!bootinfo) {
+		cprintf("Not loaded by the JOS boot loader; no boot times\n");
+		return 0;
+	}
+	// After a kexec, the first stamp is when the old kernel let go,
+	// and the times count from there.
+	if (bootinfo->bi_flags & BOOTFLAG_WARM)
+		start = bootinfo->bi_tsc[BOOTPHASE_STAGE1];
+	prev = start;
+	cprintf("%-26s %12s %12s\n", "phase", "tsc", "cycles");
+	for (i = 0; i < NBOOTPHASE; i++) {
+		if (bootinfo->bi_tsc[i] == 0)
+			continue;
+		cprintf("%-26s %12llu %12llu\n",
+			i == BOOTPHASE_STAGE1 && start ? "kexec" : bootphase_name[i],
+			bootinfo->bi_tsc[i], bootinfo->bi_tsc[i] - prev);
+		prev = bootinfo->bi_tsc[i];
+	}
+	cprintf("%-26s %12s %12llu\n", "total", "", prev - start);
+	return 0;
+}
+
+int
+mon_kexec(int argc, char **argv, struct Trapframe *tf)
+{
+	int r;
+
+	r = kexec();
+	cprintf("kexec: %e\n", r);
+	return 0;
+}
+
+int
+mon_heapstat(int argc, char **argv, struct Trapframe *tf)
+{
+	malloc_stat();
+	return 0;
+}
+
+int
+mon_vmstat(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 1)
+		vm_huge_min = strtol(argv[1], 0, 0);
+	vm_stat();
+	return 0;
+}
+
+int
+mon_ksmstat(int argc, char **argv, struct Trapframe *tf)
+{
+	ksm_stat();
+	return 0;
+}
+
+int
+mon_ksmrate(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 1)
+		ksm_rate = strtol(argv[1], 0, 0);
+	cprintf("ksm: %d pages per scan\n", ksm_rate);
+	return 0;
+}
+
+// Time page_fault_upcall, on a scratch address space, for a fault it
+// can't fix on the process stack and then for one in the handler.
+// There's no user mode to run the handler in and time the whole trip.
+int
+mon_pfbench(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Trapframe t;
+	uint64_t start, first = 0, nested = 0;
+	pde_t *pgdir;
+	int i, n = 1000, r;
+
+	if (argc > 1)
+		n = MAX(strtol(argv[1], 0, 0), 1);
+	if ((r = vm_pgdir_alloc(&pgdir)) < 0) {
+		cprintf("pfbench: %e\n", r);
+		return 0;
+	}
+	if ((r = vm_map_anon(pgdir, UXSTACKTOP - PGSIZE, PGSIZE,
+			     PTE_W|PTE_U)) < 0)
+		goto out;
+	memset(&t, 0, sizeof(t));
+	t.tf_err = FEC_U | FEC_WR;
+
+	// The first upcall brings in the exception stack; don't count it.
+	for (i = -1; i < n; i++) {
+		t.tf_esp = USTACKTOP;
+		start = read_tsc();
+		r = page_fault_upcall(pgdir, &t, 0, UTEXT);
+		if (i >= 0)
+			first += read_tsc() - start;
+		start = read_tsc();
+		r = r < 0 ? r : page_fault_upcall(pgdir, &t, 0, UTEXT);
+		if (i >= 0)
+			nested += read_tsc() - start;
+		if (r < 0)
+			goto out;
+	}
+	cprintf("pfbench: %llu cycles per upcall, %llu nested\n",
+		first / n, nested / n);
+out:
+	if (r < 0)
+		cprintf("pfbench: %e\n", r);
+	vm_pgdir_free(pgdir);
+	return 0;
+}
+
+int
+mon_tlbstat(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 1)
+		tlb_flush_ceiling = MIN(strtol(argv[1], 0, 0), TLB_GATHER_MAX);
+	cprintf("tlb: %d pages invalidated singly, %d full flushes, "
+		"%d including global\n",
+		tlb_ninvlpg, tlb_nflush, tlb_nflush_global);
+	cprintf("tlb: flush everything above %d pages\n", tlb_flush_ceiling);
+	return 0;
+}
+
 int
 mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 {
@@ -79,6 +254,20 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		(end-entry+1023)/1024);
+	if (bootinfo) {
+		struct bootseg *bs;
+
+		cprintf("Loaded by the boot loader in %llu cycles, using %s:\n",
+			bootinfo->bi_tsc[BOOTPHASE_KERNEL]
+			- bootinfo->bi_tsc[BOOTPHASE_LOAD],
+			bootinfo->bi_disk == BOOTDISK_VIRTIO ? "virtio" :
+			bootinfo->bi_disk == BOOTDISK_DMA ? "DMA" : "PIO");
+		for (bs = bootinfo->bi_seg;
+		     bs < bootinfo->bi_seg + bootinfo->bi_nseg; bs++)
+			cprintf("  segment %08x-%08x (phys)  %d bytes from %d on disk\n",
+				bs->bs_pa, bs->bs_pa + bs->bs_memsz,
+				bs->bs_filesz, bs->bs_disksz);
+	}
 	return 0;
 }
 
@@ -144,31 +333,54 @@ overflow_me(void)
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
-
+	// One stack frame, looked up while walking the stack and printed
+	// once the walk is done.
+	struct Frame {
+		struct Frame *f_next;
+		uint32_t f_ebp, f_eip;
+		uint32_t f_args[5];
+		struct Eipdebuginfo f_info;
+	} *f, *frames = NULL, **tail = &frames;
+	struct Arena *ar = monitor_arena(), *own = NULL;
 	uint32_t ebp = read_ebp();
 	uint32_t ret_addr = *(uint32_t*)(ebp+4);
 	int i;
-	struct Eipdebuginfo info;
 
-	cprintf("Stack backtrace:\n");
+	// Called from outside a command, as by test_backtrace.
+	if (ar == NULL && (ar = own = arena_create()) == NULL) {
+		cprintf("backtrace: %e\n", -E_NO_MEM);
+		return 0;
+	}
 	while (ebp!=0) {
-		debuginfo_eip(ret_addr, &info);
-
-		cprintf("  eip %08x  ebp %08x  args", ret_addr, ebp);
-		for (i=0; i<5 /*info.eip_fn_narg*/; i++) {
-			cprintf(" %08x", *(uint32_t*)(ebp+8+4*i));
-		}
-		cprintf("\n");
-
-		cprintf("          %s:%d: ", info.eip_file, info.eip_line);
-		for (i=0; i<info.eip_fn_namelen; i++)
-			cprintf("%c", info.eip_fn_name[i]);
-		cprintf("+%d\n", ret_addr - info.eip_fn_addr);
+		if ((f = arena_alloc(ar, sizeof(*f), 4)) == NULL)
+			break;
+		f->f_ebp = ebp;
+		f->f_eip = ret_addr;
+		for (i=0; i<5 /*info.eip_fn_narg*/; i++)
+			f->f_args[i] = *(uint32_t*)(ebp+8+4*i);
+		debuginfo_eip(ret_addr, &f->f_info);
+		f->f_next = NULL;
+		*tail = f;
+		tail = &f->f_next;
 
 		ebp = *(uint32_t*)ebp;
 		ret_addr = *(uint32_t*)(ebp+4);
 	}
 
+	cprintf("Stack backtrace:\n");
+	for (f = frames; f; f = f->f_next) {
+		cprintf("  eip %08x  ebp %08x  args", f->f_eip, f->f_ebp);
+		for (i=0; i<5; i++)
+			cprintf(" %08x", f->f_args[i]);
+		cprintf("\n          %s:%d: %.*s+%d\n", f->f_info.eip_file,
+			f->f_info.eip_line, f->f_info.eip_fn_namelen,
+			f->f_info.eip_fn_name, f->f_eip - f->f_info.eip_fn_addr);
+	}
+	if (ebp != 0)
+		cprintf("  (out of memory for more frames)\n");
+	if (own)
+		arena_destroy(own);
+
 	// Your code here.
     overflow_me();
     cprintf("Backtrace success\n");
@@ -184,7 +396,7 @@ runcmd(char *buf, struct Trapframe *tf)
 {
 	int argc;
 	char *argv[MAXARGS];
-	int i;
+	int i, r;
 
 	// Parse the command buffer into whitespace-separated arguments
 	argc = 0;
@@ -211,8 +423,14 @@ runcmd(char *buf, struct Trapframe *tf)
 	if (argc == 0)
 		return 0;
 	for (i = 0; i < NCOMMANDS; i++) {
-		if (strcmp(argv[0], commands[i].name) == 0)
-			return commands[i].func(argc, argv, tf);
+		if (strcmp(argv[0], commands[i].name) == 0) {
+			cmd_arena = arena_create();
+			r = commands[i].func(argc, argv, tf);
+			if (cmd_arena)
+				arena_destroy(cmd_arena);
+			cmd_arena = NULL;
+			return r;
+		}
 	}
 	cprintf("Unknown command '%s'\n", argv[0]);
 	return 0;
@@ -5,16 +5,27 @@
 #endif
 
 struct Trapframe;
+struct Arena;
 
 // Activate the kernel monitor,
 // optionally providing a trap frame indicating the current state
 // (NULL if none).
 void monitor(struct Trapframe *tf);
 
+struct Arena *monitor_arena(void);
+
 // Functions implementing monitor commands.
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
 int mon_time(int argc, char **argv, struct Trapframe *tf);
+int mon_boottime(int argc, char **argv, struct Trapframe *tf);
+int mon_kexec(int argc, char **argv, struct Trapframe *tf);
+int mon_heapstat(int argc, char **argv, struct Trapframe *tf);
+int mon_vmstat(int argc, char **argv, struct Trapframe *tf);
+int mon_ksmstat(int argc, char **argv, struct Trapframe *tf);
+int mon_ksmrate(int argc, char **argv, struct Trapframe *tf);
+int mon_pfbench(int argc, char **argv, struct Trapframe *tf);
+int mon_tlbstat(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -0,0 +1,970 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/pmap.h>
+#include <kern/vm.h>
+
+// These variables are set by i386_detect_memory()
+physaddr_t maxpa;	// Maximum physical address
+size_t npage;		// Amount of physical memory (in pages)
+static size_t basemem;	// Amount of base memory (in bytes)
+static size_t extmem;	// Amount of extended memory (in bytes)
+static uint64_t highmem;	// Amount of memory above MAXPA (in bytes)
+static struct multiboot_info *boot_mbi;	// What the boot loader told us
+
+// These variables are set in page_init()
+static char *boot_freemem;	// Pointer to next byte of free mem
+struct Page *pages;		// Virtual address of physical page array
+
+// The buddy allocator's free lists: page_free_list[z][k] holds free
+// blocks of 2^k pages in zone z, each aligned to a multiple of its size.
+// ZONE_HIGH is the memory above MAXPA, which only ALLOC_HIGH callers
+// get; blocks never span both zones, since MAXPA is a multiple of the
+// largest block.
+#define ZONE_LOW	0
+#define ZONE_HIGH	1
+#define NZONE		2
+static struct Page_list page_free_list[NZONE][PAGE_MAXORDER + 1];
+static size_t nfree;		// free pages on all the lists
+static size_t nfree_high;	// ... in ZONE_HIGH
+
+// Single pages zeroed ahead of time, for page_alloc(ALLOC_ZERO).  The
+// idle loop keeps up to ZERO_POOL_MAX of them; they still count as free
+// and go back to the buddy lists when those run dry.
+#define ZERO_POOL_MAX	64
+static struct Page_list page_zero_list;
+static size_t nzero;		// pages on page_zero_list
+static bool zero_nt;		// the CPU has movnti
+
+// The page table for the kmap slots at KMAPBASE, and how many are in use
+static pte_t *kmap_pt;
+static int kmap_depth;
+
+// With PAE, physical addresses go up to 64GB
+#define PAE_MAXPA	((uint64_t) 1 << 36)
+
+static void check_page_alloc(void);
+static void check_zero_pool(void);
+static void check_kmap(void);
+
+// How far up physical memory the page allocator can manage, given
+// 'lowmem' bytes below MAXPA.  Without PAE, that's only what KERNBASE
+// maps.  With PAE, memory above that is for pages the kernel needn't
+// map, but the struct Pages for all of it have to fit below MAXPA next
+// to the kernel: allow them a quarter of low memory.
+static uint64_t
+phys_limit(uint64_t lowmem)
+{
+#ifndef JOS_PAE
+	return MAXPA;
+#else
+	uint64_t limit = lowmem / 4 / sizeof(struct Page) * PGSIZE;
+
+	return MAX((uint64_t) MAXPA, MIN(limit, PAE_MAXPA));
+#endif
+}
+
+// Size physical memory from what the boot loader told us in 'mbi'
+// (NULL if nothing), preferring the BIOS memory map if there is one.
+// Without any information, assume just 4MB, which any PC has.
+void
+i386_detect_memory(struct multiboot_info *mbi)
+{
+	struct multiboot_mmap_entry *e;
+	uint32_t mmap, emmap;
+	uint64_t end, limit = MAXPA, lost = 0;
+
+	boot_mbi = mbi;
+	if (mbi && (mbi->mi_flags & MULTIBOOT_INFO_MEM_MAP)) {
+		// The map is in low memory, which KERNBASE maps.
+		mmap = KERNBASE + mbi->mi_mmap_addr;
+		emmap = mmap + mbi->mi_mmap_length;
+		// The memory below MAXPA decides how much we can use above.
+		for (end = 0; mmap < emmap; mmap += e->mm_size + 4) {
+			e = (struct multiboot_mmap_entry *) mmap;
+			if (e->mm_type == MULTIBOOT_MEMORY_AVAILABLE
+			    && e->mm_addr < MAXPA)
+				end += MIN(e->mm_addr + e->mm_len,
+					   (uint64_t) MAXPA) - e->mm_addr;
+		}
+		limit = phys_limit(end);
+
+		mmap = KERNBASE + mbi->mi_mmap_addr;
+		for (; mmap < emmap; mmap += e->mm_size + 4) {
+			e = (struct multiboot_mmap_entry *) mmap;
+			if (e->mm_type != MULTIBOOT_MEMORY_AVAILABLE)
+				continue;
+			end = e->mm_addr + e->mm_len;
+			if (end > limit) {
+				lost += end - MAX(e->mm_addr, limit);
+				end = limit;
+			}
+			if (e->mm_addr == 0)
+				basemem = MIN(end, IOPHYSMEM);
+			else if (e->mm_addr <= EXTPHYSMEM && end > EXTPHYSMEM)
+				extmem = MIN(end, (uint64_t) MAXPA) - EXTPHYSMEM;
+			if (end > MAX(e->mm_addr, (uint64_t) MAXPA))
+				highmem += end - MAX(e->mm_addr, (uint64_t) MAXPA);
+			if (e->mm_addr < end)
+				maxpa = MAX(maxpa, (physaddr_t)
+					    (end & ~(uint64_t) (PGSIZE - 1)));
+		}
+	} else if (mbi && (mbi->mi_flags & MULTIBOOT_INFO_MEMORY)) {
+		basemem = ROUNDDOWN(mbi->mi_mem_lower * 1024, PGSIZE);
+		extmem = ROUNDDOWN(MIN(mbi->mi_mem_upper * 1024,
+				       MAXPA - EXTPHYSMEM), PGSIZE);
+	} else {
+		basemem = IOPHYSMEM;
+		extmem = 0x400000 - EXTPHYSMEM;
+	}
+
+	// Calculate the maximum physical address based on whether
+	// or not there is any extended memory.
+	if (maxpa == 0)
+		maxpa = extmem ? EXTPHYSMEM + extmem : basemem;
+	npage = maxpa >> PGSHIFT;
+
+	cprintf("Physical memory: %dK available, ", (int)(maxpa >> 10));
+	cprintf("base = %dK, extended = %dK", (int)(basemem/1024),
+		(int)(extmem/1024));
+	if (highmem)
+		cprintf(", high = %dK", (int)(highmem >> 10));
+	cprintf("\n");
+	if (lost)
+		cprintf("Ignoring %dMB of memory above %dMB\n",
+			(int)(lost >> 20), (int)(limit >> 20));
+}
+
+// This simple physical memory allocator is used only while JOS is setting
+// up its memory management, before page_init: it hands out the memory
+// just past the end of the kernel, which is never freed.
+//
+// Allocate 'n' bytes of physical memory aligned on an 'align'-byte
+// boundary.  Returns a kernel virtual address.
+static void*
+boot_alloc(uint32_t n, uint32_t align)
+{
+	extern char end[];
+	void *v;
+
+	// Initialize boot_freemem if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment -
+	// i.e., the first virtual address that the linker
+	// did _not_ assign to any kernel code or global variables.
+	if (boot_freemem == 0)
+		boot_freemem = end;
+
+	boot_freemem = ROUNDUP(boot_freemem, align);
+	v = boot_freemem;
+	boot_freemem += n;
+	if (PADDR(boot_freemem) > MIN(maxpa, (physaddr_t) MAXPA))
+		panic("boot_alloc: out of memory");
+	return v;
+}
+
+// Zero 'n' bytes at 'va', a multiple of 4 bytes and 4-byte aligned.
+// With SSE2, use non-temporal stores, which go around the caches: the
+// memory we zero ahead of time shouldn't push out what's in use.
+static void
+zero_mem(void *va, size_t n)
+{
+	uint32_t *p = va, *ep = p + n / 4;
+
+	if (!zero_nt) {
+		memset(va, 0, n);
+		return;
+	}
+	for (; p < ep; p++)
+		asm volatile("movnti %1, %0" : "=m" (*p) : "r" (0));
+	asm volatile("sfence" ::: "memory");
+}
+
+static int
+page_zone(struct Page *pp)
+{
+	return page2pa(pp) >= MAXPA ? ZONE_HIGH : ZONE_LOW;
+}
+
+// Put the block of 2^order pages at 'pp' on its free list.
+static void
+buddy_insert(struct Page *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	LIST_INSERT_HEAD(&page_free_list[page_zone(pp)][order], pp, pp_link);
+}
+
+// Return the block of 2^order pages at 'pp' to the free lists.  As long
+// as its buddy -- the other half of the block twice its size -- is free
+// too, take the buddy off its list and go up an order.
+static void
+buddy_free(struct Page *pp, int order)
+{
+	ppn_t ppn = page2ppn(pp), bppn;
+	struct Page *buddy;
+
+	nfree += 1 << order;
+	if (page_zone(pp) == ZONE_HIGH)
+		nfree_high += 1 << order;
+	for (; order < PAGE_MAXORDER; order++) {
+		bppn = ppn ^ (1 << order);
+		if (bppn >= npage)
+			break;
+		buddy = &pages[bppn];
+		if (!(buddy->pp_flags & PP_FREE) || buddy->pp_order != order)
+			break;
+		LIST_REMOVE(buddy, pp_link);
+		buddy->pp_flags &= ~PP_FREE;
+		ppn &= ~(1 << order);
+	}
+	buddy_insert(&pages[ppn], order);
+}
+
+// Free the pages in [start, end), which must be page aligned, in the
+// largest aligned blocks that fit.
+static void
+page_free_range(physaddr_t start, physaddr_t end)
+{
+	ppn_t ppn = PPN(start), eppn = PPN(end);
+	int order;
+
+	while (ppn < eppn) {
+		for (order = PAGE_MAXORDER; order > 0; order--)
+			if ((ppn & ((1 << order) - 1)) == 0
+			    && ppn + (1 << order) <= eppn)
+				break;
+		buddy_free(&pages[ppn], order);
+		ppn += 1 << order;
+	}
+}
+
+// Free the usable RAM in [start, end), leaving out page 0 (the
+// real-mode IDT and BIOS data), the I/O hole, and the kernel along
+// with everything boot_alloc has handed out.
+static void
+page_free_ram(physaddr_t start, physaddr_t end)
+{
+	start = MAX(start, (physaddr_t) PGSIZE);
+	start = (start + PGSIZE - 1) & ~(physaddr_t) (PGSIZE - 1);
+	end = MIN(end, maxpa) & ~(physaddr_t) (PGSIZE - 1);
+	if (start < IOPHYSMEM)
+		page_free_range(start, MIN(end, (physaddr_t) IOPHYSMEM));
+	start = MAX(start, PADDR(ROUNDUP(boot_freemem, PGSIZE)));
+	if (start < end)
+		page_free_range(start, end);
+}
+
+// Set up the Page structures for all of physical memory and put the
+// usable pages on the free lists.  After this, page_alloc and friends
+// are the only way to get memory.
+void
+page_init(void)
+{
+	extern pde_t entry_pgdir[];
+	struct multiboot_mmap_entry *e;
+	struct Page *pp;
+	uint32_t mmap, emmap, edx;
+	int i;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	zero_nt = (edx & CPUID_FEAT_SSE2) != 0;
+
+	pages = boot_alloc(npage * sizeof(struct Page), PGSIZE);
+	zero_mem(pages, npage * sizeof(struct Page));
+	for (i = 0; i <= PAGE_MAXORDER; i++) {
+		LIST_INIT(&page_free_list[ZONE_LOW][i]);
+		LIST_INIT(&page_free_list[ZONE_HIGH][i]);
+	}
+	LIST_INIT(&page_zero_list);
+
+	if (boot_mbi && (boot_mbi->mi_flags & MULTIBOOT_INFO_MEM_MAP)) {
+		mmap = KERNBASE + boot_mbi->mi_mmap_addr;
+		emmap = mmap + boot_mbi->mi_mmap_length;
+		for (; mmap < emmap; mmap += e->mm_size + 4) {
+			e = (struct multiboot_mmap_entry *) mmap;
+			if (e->mm_type == MULTIBOOT_MEMORY_AVAILABLE
+			    && e->mm_addr < maxpa)
+				page_free_ram(e->mm_addr,
+					      MIN(e->mm_addr + e->mm_len,
+						  (uint64_t) maxpa));
+		}
+	} else {
+		page_free_ram(0, basemem);
+		page_free_ram(EXTPHYSMEM, EXTPHYSMEM + extmem);
+	}
+	if (nfree_high)
+		cprintf("Free memory: %d pages, %d of them above %dMB\n",
+			nfree, nfree_high, MAXPA >> 20);
+
+	// The page table for kmap, which every address space shares:
+	// vm_pgdir_alloc copies the kernel's part of entry_pgdir.
+	if (page_alloc(&pp, ALLOC_ZERO) < 0)
+		panic("page_init: no page for kmap");
+	pp->pp_ref = 1;
+	kmap_pt = page2kva(pp);
+	entry_pgdir[PDX(KMAPBASE)] = page2pa(pp) | PTE_P | PTE_W;
+
+	check_page_alloc();
+	check_zero_pool();
+	check_kmap();
+}
+
+// Map 'pp' where the kernel can get at it, until kunmap.  Pages below
+// MAXPA are at page2kva already; others take one of NKMAP slots, which
+// must be given back in the reverse order.
+void *
+kmap(struct Page *pp)
+{
+	void *va;
+
+	if (page2pa(pp) < MAXPA)
+		return page2kva(pp);
+	if (kmap_depth == NKMAP)
+		panic("kmap: out of slots");
+	va = (void *) (KMAPBASE + kmap_depth++ * PGSIZE);
+	kmap_pt[PTX(va)] = page2pa(pp) | PTE_P | PTE_W;
+	invlpg(va);
+	return va;
+}
+
+void
+kunmap(void *va)
+{
+	if ((uintptr_t) va >= KERNBASE)
+		return;
+	assert(va == (void *) (KMAPBASE + (kmap_depth - 1) * PGSIZE));
+	kmap_pt[PTX(va)] = 0;
+	invlpg(va);
+	kmap_depth--;
+}
+
+// The smallest order >= 'order' with a free block for an allocation
+// with 'alloc_flags', and its zone in '*zone', or PAGE_MAXORDER + 1 if
+// there is none.  High memory goes first to those who can use it, to
+// leave the rest for those who can't.
+static int
+buddy_find(int order, int alloc_flags, int *zone)
+{
+	int z, o;
+
+	for (z = (alloc_flags & ALLOC_HIGH) ? ZONE_HIGH : ZONE_LOW; z >= 0; z--)
+		for (o = order; o <= PAGE_MAXORDER; o++)
+			if (!LIST_EMPTY(&page_free_list[z][o])) {
+				*zone = z;
+				return o;
+			}
+	return PAGE_MAXORDER + 1;
+}
+
+// Is there a free block of 2^order pages, without reclaiming any?
+bool
+page_have_block(int order, int alloc_flags)
+{
+	int zone;
+
+	return buddy_find(order, alloc_flags, &zone) <= PAGE_MAXORDER;
+}
+
+//
+// Allocates a naturally aligned block of 2^order physical pages, taking
+// the smallest free block that's big enough and splitting off halves of
+// it until it's the right size.  Zeroes the pages if (alloc_flags &
+// ALLOC_ZERO).  Unless (alloc_flags & ALLOC_HIGH), the pages are below
+// MAXPA, so page2kva works for them.
+//
+// *pp_store -- is set to point to the Page struct of the block's first
+// page, which is also what to pass to page_free.
+//
+// RETURNS
+//   0 -- on success
+//   -E_NO_MEM -- otherwise
+//
+int
+page_alloc_order(struct Page **pp_store, int order, int alloc_flags)
+{
+	struct Page *pp;
+	void *va;
+	int o, zone, i;
+
+	assert(order >= 0 && order <= PAGE_MAXORDER);
+	o = buddy_find(order, alloc_flags, &zone);
+	if (o > PAGE_MAXORDER && nzero > 0) {
+		// Out of free blocks, but the zero pool may make some.
+		while ((pp = LIST_FIRST(&page_zero_list)) != NULL) {
+			LIST_REMOVE(pp, pp_link);
+			nzero--;
+			buddy_free(pp, 0);
+		}
+		o = buddy_find(order, alloc_flags, &zone);
+	}
+	if (o > PAGE_MAXORDER && vm_reclaim(1 << order) > 0)
+		o = buddy_find(order, alloc_flags, &zone);
+	if (o > PAGE_MAXORDER)
+		return -E_NO_MEM;
+
+	pp = LIST_FIRST(&page_free_list[zone][o]);
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_FREE;
+	while (o > order) {
+		o--;
+		buddy_insert(pp + (1 << o), o);
+	}
+	pp->pp_order = order;
+	pp->pp_ref = 0;
+	nfree -= 1 << order;
+	if (zone == ZONE_HIGH)
+		nfree_high -= 1 << order;
+	if (alloc_flags & ALLOC_ZERO)
+		for (i = 0; i < (1 << order); i++) {
+			va = kmap(pp + i);
+			memset(va, 0, PGSIZE);
+			kunmap(va);
+		}
+	*pp_store = pp;
+	return 0;
+}
+
+// Allocates a single physical page.  If (alloc_flags & ALLOC_ZERO),
+// the page is filled with zeroes, preferably by taking one that the
+// idle loop zeroed already.
+int
+page_alloc(struct Page **pp_store, int alloc_flags)
+{
+	struct Page *pp;
+
+	if ((alloc_flags & ALLOC_ZERO)
+	    && (pp = LIST_FIRST(&page_zero_list)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		nzero--;
+		pp->pp_ref = 0;
+		*pp_store = pp;
+		return 0;
+	}
+	return page_alloc_order(pp_store, 0, alloc_flags);
+}
+
+// Zero a free page for the pool, if it's short.  Called when there's
+// nothing better to do (while the monitor waits for a key), so it does
+// one page at a time to keep the wait for the next key short.
+void
+page_zero_idle(void)
+{
+	struct Page *pp;
+
+	if (nzero >= ZERO_POOL_MAX || nfree == nfree_high
+	    || page_alloc_order(&pp, 0, 0) < 0)
+		return;
+	zero_mem(page2kva(pp), PGSIZE);
+	LIST_INSERT_HEAD(&page_zero_list, pp, pp_link);
+	nzero++;
+}
+
+//
+// Return a block to the free lists.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free(struct Page *pp)
+{
+	if (pp->pp_ref)
+		panic("page_free: freeing page with nonzero refcount");
+	if (pp->pp_flags & PP_FREE)
+		panic("page_free: freeing free page");
+	if (pp->pp_flags & (PP_ANON|PP_KSM|PP_HUGE|PP_SHARED))
+		vm_page_forget(pp);
+	buddy_free(pp, pp->pp_order);
+}
+
+// Make the allocated block at 'pp' into 2^pp_order single pages, each
+// with no references, to be freed one by one.
+void
+page_split(struct Page *pp)
+{
+	uint32_t i, n = 1 << pp->pp_order;
+
+	for (i = 0; i < n; i++) {
+		pp[i].pp_order = 0;
+		if (i > 0) {
+			pp[i].pp_ref = 0;
+			pp[i].pp_flags = 0;
+		}
+	}
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct Page* pp)
+{
+	if (--pp->pp_ref == 0)
+		page_free(pp);
+	else if (pp->pp_ref == 1 && (pp->pp_flags & PP_SHARED))
+		vm_page_unshare(pp);
+}
+
+// Number of free pages, zeroed or not
+size_t
+page_nfree(void)
+{
+	return nfree + nzero;
+}
+
+// Given 'pgdir', a pointer to a page directory, pgdir_walk returns
+// a pointer to the page table entry (PTE) for linear address 'va'.
+// This requires walking the two-level page table structure.
+//
+// If the relevant page table doesn't exist in the page directory, then:
+//    - If create == 0, pgdir_walk returns NULL.
+//    - Otherwise, pgdir_walk tries to allocate a new, zeroed page table
+//	with page_alloc.  If this fails, pgdir_walk returns NULL.
+//
+// The page directory entry gets the most permissive permissions; the
+// page table entries say what's really allowed.
+//
+// If 'va' is in a superpage (PTE_PS), there is no page table, and
+// pgdir_walk returns the page directory entry that maps it, which has
+// the same layout -- unless 'create' is set, since the caller means to
+// change the entry for one page: then it splits the superpage first.
+pte_t *
+pgdir_walk(pde_t *pgdir, const void *va, int create)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct Page *pp;
+
+	if ((*pde & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS)) {
+		if (!create)
+			return (pte_t *) pde;
+		vm_huge_split(pa2page(PTE_ADDR(*pde)));
+	}
+	if (!(*pde & PTE_P)) {
+		if (!create || page_alloc(&pp, ALLOC_ZERO) < 0)
+			return NULL;
+		pp->pp_ref = 1;
+		*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	}
+	return (pte_t *) KADDR(PTE_ADDR(*pde)) + PTX(va);
+}
+
+//
+// Map the physical page 'pp' at virtual address 'va'.
+// The permissions (the low 12 bits) of the page table
+// entry should be set to 'perm|PTE_P'.
+//
+// If there is already a page mapped at 'va', it is page_remove()d.
+// pp->pp_ref is incremented if the insertion succeeds.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if page table couldn't be allocated
+//
+int
+page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
+{
+	pte_t *pte;
+
+	if ((pte = pgdir_walk(pgdir, va, 1)) == NULL)
+		return -E_NO_MEM;
+	// Take the reference first, in case 'pp' is already mapped at 'va'.
+	pp->pp_ref++;
+	if (*pte & PTE_P)
+		page_remove(pgdir, va);
+	*pte = page2pa(pp) | perm | PTE_P;
+	tlb_invalidate(pgdir, va);
+	return 0;
+}
+
+//
+// Return the page mapped at virtual address 'va', or NULL if there is
+// none.  If pte_store is not zero, then we store in it the address
+// of the pte for this page.
+//
+struct Page *
+page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
+{
+	pte_t *pte;
+
+	if ((pte = pgdir_walk(pgdir, va, 0)) == NULL || !(*pte & PTE_P))
+		return NULL;
+	if (pte_store)
+		*pte_store = pte;
+	if (*pte & PTE_PS)
+		return pa2page(PTE_ADDR(*pte)) + PTX(va);
+	return pa2page(PTE_ADDR(*pte));
+}
+
+//
+// Unmaps the physical page at virtual address 'va'.
+// If there is no physical page at that address, silently does nothing.
+//
+// Details:
+//   - The ref count on the physical page should decrement.
+//   - The physical page should be freed if the refcount reaches 0.
+//   - The pg table entry corresponding to 'va' should be set to 0.
+//   - The TLB must be invalidated if you remove an entry from
+//	   the pg dir/pg table.
+//
+void
+page_remove(pde_t *pgdir, void *va)
+{
+	struct Page *pp;
+	pte_t *pte;
+
+	if ((pp = page_lookup(pgdir, va, &pte)) == NULL)
+		return;
+	if (*pte & PTE_PS) {
+		// Only this page goes, so the rest needs a page table.
+		vm_huge_split(pa2page(PTE_ADDR(*pte)));
+		pte = pgdir_walk(pgdir, va, 0);
+	}
+	*pte = 0;
+	tlb_invalidate(pgdir, va);
+	page_decref(pp);
+}
+
+// What %cr3 holds while 'pgdir' is in use: its physical address, or
+// with PAE, that of its page-directory-pointer table, which
+// vm_pgdir_alloc keeps in pp_free of the directory's first page.
+physaddr_t
+pgdir_cr3(pde_t *pgdir)
+{
+#ifndef JOS_PAE
+	return PADDR(pgdir);
+#else
+	extern pde_t entry_pgdir[];
+	extern pdpe_t entry_pdpt[];
+
+	if (pgdir == entry_pgdir)
+		return PADDR(entry_pdpt);
+	return PADDR(pa2page(PADDR(pgdir))->pp_free);
+#endif
+}
+
+// Is 'pgdir' the address space the processor is using?
+static bool
+pgdir_current(pde_t *pgdir)
+{
+	return rcr3() == pgdir_cr3(pgdir);
+}
+
+//
+// Invalidate a TLB entry, but only if the page tables being
+// edited are the ones currently in use by the processor.
+//
+void
+tlb_invalidate(pde_t *pgdir, void *va)
+{
+	// Flush the entry only if we're modifying the current address space.
+	if (!pgdir_current(pgdir) && (uintptr_t) va < UTOP)
+		return;
+	invlpg(va);
+	tlb_ninvlpg++;
+}
+
+// Beyond this many pages, tlb_gather_commit flushes the whole TLB.  An
+// invlpg costs a few hundred cycles; a flush costs a TLB miss for each
+// page in use afterwards, which with page walks mostly hitting the cache
+// is on the order of a hundred cycles each.  Flushing a few dozen
+// entries one by one is about even with refilling a working set.
+uint32_t tlb_flush_ceiling = 32;
+
+// How TLB entries were invalidated, for tlbstat
+uint32_t tlb_ninvlpg, tlb_nflush, tlb_nflush_global;
+
+// Start gathering invalidations for the page tables of 'pgdir'.
+void
+tlb_gather_init(struct tlb_gather *tg, pde_t *pgdir)
+{
+	tg->tg_pgdir = pgdir;
+	tg->tg_n = 0;
+	tg->tg_kernel = 0;
+	LIST_INIT(&tg->tg_free);
+}
+
+// Note that the mapping of 'va' changed.  Mappings above UTOP are the
+// kernel's, which are the same in every address space.
+void
+tlb_gather_add(struct tlb_gather *tg, void *va)
+{
+	if ((uintptr_t) va >= UTOP)
+		tg->tg_kernel = 1;
+	if (tg->tg_n < TLB_GATHER_MAX)
+		tg->tg_va[tg->tg_n] = (uintptr_t) va;
+	tg->tg_n++;
+}
+
+// page_decref for a page whose mapping 'tg' has gathered: if that was
+// the last reference, the page is freed by tlb_gather_commit.
+void
+tlb_gather_decref(struct tlb_gather *tg, struct Page *pp)
+{
+	if (pp->pp_ref > 1) {
+		page_decref(pp);
+		return;
+	}
+	pp->pp_ref = 0;
+	// off the reclaim, KSM or superpage list, for pp_link
+	if (pp->pp_flags & (PP_ANON|PP_KSM|PP_HUGE|PP_SHARED))
+		vm_page_forget(pp);
+	LIST_INSERT_HEAD(&tg->tg_free, pp, pp_link);
+}
+
+// Invalidate the TLB entries gathered so far, if they're for the
+// address space in use or the kernel's, free the pages they mapped,
+// and start over.
+void
+tlb_gather_commit(struct tlb_gather *tg)
+{
+	struct Page *pp;
+	uint32_t i;
+
+	if (tg->tg_n == 0 || (!tg->tg_kernel && !pgdir_current(tg->tg_pgdir)))
+		;
+	else if (tg->tg_n <= MIN(tlb_flush_ceiling, TLB_GATHER_MAX)) {
+		for (i = 0; i < tg->tg_n; i++)
+			invlpg((void *) tg->tg_va[i]);
+		tlb_ninvlpg += tg->tg_n;
+	} else if (tg->tg_kernel) {
+		// The kernel's mappings are global: reloading %cr3 keeps them.
+		tlbflush_global();
+		tlb_nflush_global++;
+	} else {
+		tlbflush();
+		tlb_nflush++;
+	}
+	tg->tg_n = 0;
+	tg->tg_kernel = 0;
+	while ((pp = LIST_FIRST(&tg->tg_free)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		page_free(pp);
+	}
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+// Is 'pp' the head of a free block of 2^order pages?
+static bool
+check_free_block(struct Page *pp, int order)
+{
+	return (pp->pp_flags & PP_FREE) && pp->pp_order == order;
+}
+
+//
+// Check the buddy allocator: alignment at each order, splitting and
+// merging, and which memory each zone hands out.  Everything allocated
+// goes back, so the free counts must come out where they started.
+//
+static void
+check_page_alloc(void)
+{
+	size_t nfree0 = nfree, nfree_high0 = nfree_high;
+	struct Page_list held;
+	struct Page *pp, *pp2;
+	int o;
+
+	// blocks of every order are naturally aligned and counted
+	for (o = 0; o <= PAGE_MAXORDER; o++) {
+		if (!page_have_block(o, 0))
+			continue;
+		assert(page_alloc_order(&pp, o, 0) == 0);
+		assert(pp->pp_order == o && !(pp->pp_flags & PP_FREE));
+		assert((page2ppn(pp) & ((1 << o) - 1)) == 0);
+		assert(page2pa(pp) < MAXPA);
+		assert(nfree == nfree0 - (1 << o));
+		page_free(pp);
+		assert(nfree == nfree0);
+	}
+
+	// Split a block of 4 into pages p0..p3 and free them one by one.
+	assert(page_alloc_order(&pp, 2, 0) == 0);
+	page_split(pp);
+	for (o = 0; o < 4; o++)
+		assert(pp[o].pp_order == 0 && pp[o].pp_ref == 0);
+	// p2's buddy p3 is in use, so it stays alone
+	page_free(&pp[2]);
+	assert(check_free_block(&pp[2], 0));
+	// p0 and p1 merge, but not with p2: it's free, but of order 0
+	page_free(&pp[0]);
+	assert(check_free_block(&pp[0], 0));
+	page_free(&pp[1]);
+	assert(check_free_block(&pp[0], 1));
+	assert(!(pp[1].pp_flags & PP_FREE));
+	assert(check_free_block(&pp[2], 0));
+	// p3 joins p2, and the pair joins p0-p1, at least
+	page_free(&pp[3]);
+	assert((pp[0].pp_flags & PP_FREE) && pp[0].pp_order >= 2);
+	assert(!(pp[2].pp_flags & PP_FREE));
+	assert(nfree == nfree0);
+
+	// ALLOC_HIGH memory comes from above MAXPA while there's any there,
+	// and from below once there isn't; without it, always from below.
+	LIST_INIT(&held);
+	for (o = PAGE_MAXORDER; o >= 0; o--)
+		while (!LIST_EMPTY(&page_free_list[ZONE_HIGH][o])) {
+			assert(page_alloc_order(&pp, o, ALLOC_HIGH) == 0);
+			assert(page_zone(pp) == ZONE_HIGH);
+			LIST_INSERT_HEAD(&held, pp, pp_link);
+		}
+	assert(nfree_high == 0);
+	assert(page_alloc(&pp2, ALLOC_HIGH) == 0);
+	assert(page_zone(pp2) == ZONE_LOW);
+	page_free(pp2);
+	while ((pp = LIST_FIRST(&held)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		page_free(pp);
+	}
+	assert(nfree == nfree0 && nfree_high == nfree_high0);
+	if (nfree_high) {
+		assert(page_alloc(&pp, ALLOC_HIGH) == 0);
+		assert(page_zone(pp) == ZONE_HIGH);
+		page_free(pp);
+	}
+	for (o = 0; o < 8; o++) {
+		assert(page_alloc(&pp, 0) == 0);
+		assert(page_zone(pp) == ZONE_LOW);
+		page_free(pp);
+	}
+
+	assert(nfree == nfree0 && nfree_high == nfree_high0);
+	cprintf("check_page_alloc() succeeded!\n");
+}
+
+static bool
+check_page_zero(struct Page *pp)
+{
+	uint32_t *va = kmap(pp);
+	int i;
+
+	for (i = 0; i < PGSIZE / 4 && va[i] == 0; i++)
+		;
+	kunmap(va);
+	return i == PGSIZE / 4;
+}
+
+static void
+check_page_dirty(struct Page *pp)
+{
+	void *va = kmap(pp);
+
+	memset(va, 0xa5, PGSIZE);
+	kunmap(va);
+}
+
+//
+// Check that ALLOC_ZERO pages are zero whether they come from the pool
+// page_zero_idle fills or from the free lists, including after pages
+// that were handed out zeroed went back dirty.  Leaves the pool empty.
+//
+static void
+check_zero_pool(void)
+{
+	size_t nfree0 = page_nfree();
+	struct Page_list held;
+	struct Page *pp;
+	int i, round;
+
+	LIST_INIT(&held);
+	for (round = 0; round < 2; round++) {
+		// fill the pool the way the idle loop does
+		for (i = 0; i < ZERO_POOL_MAX; i++)
+			page_zero_idle();
+		assert(nzero > 0 || nfree == nfree_high);
+		assert(page_nfree() == nfree0);
+
+		// take it all, and write over every page
+		while (nzero > 0) {
+			i = nzero;
+			assert(page_alloc(&pp, ALLOC_ZERO) == 0);
+			assert(nzero == i - 1 && pp->pp_order == 0);
+			assert(!(pp->pp_flags & PP_FREE));
+			assert(check_page_zero(pp));
+			check_page_dirty(pp);
+			LIST_INSERT_HEAD(&held, pp, pp_link);
+		}
+		// The dirty pages go back to the free lists, where the next
+		// round's page_zero_idle finds them first.
+		while ((pp = LIST_FIRST(&held)) != NULL) {
+			LIST_REMOVE(pp, pp_link);
+			page_free(pp);
+		}
+		assert(page_nfree() == nfree0);
+	}
+
+	// with the pool empty, ALLOC_ZERO zeroes what the free lists give
+	assert(page_alloc_order(&pp, 1, 0) == 0);
+	check_page_dirty(&pp[0]);
+	check_page_dirty(&pp[1]);
+	page_free(pp);
+	assert(page_alloc_order(&pp, 1, ALLOC_ZERO) == 0);
+	assert(check_page_zero(&pp[0]) && check_page_zero(&pp[1]));
+	page_free(pp);
+	if (nfree_high) {
+		assert(page_alloc(&pp, ALLOC_HIGH) == 0);
+		check_page_dirty(pp);
+		page_free(pp);
+		assert(page_alloc(&pp, ALLOC_ZERO|ALLOC_HIGH) == 0);
+		assert(page_zone(pp) == ZONE_HIGH && check_page_zero(pp));
+		page_free(pp);
+	}
+
+	assert(nzero == 0 && page_nfree() == nfree0);
+	cprintf("check_zero_pool() succeeded!\n");
+}
+
+//
+// Check kmap: pages below MAXPA are where KERNBASE maps them; pages above
+// get slots, one per nested kmap, through which what's written to a page
+// is what's read back the next time it's mapped.
+//
+static void
+check_kmap(void)
+{
+	struct Page *pp, *pp2;
+	uint32_t *va, *va2;
+
+	assert(page_alloc(&pp, 0) == 0);
+	assert(kmap(pp) == page2kva(pp));
+	kunmap(page2kva(pp));
+	page_free(pp);
+	if (!nfree_high) {
+		cprintf("check_kmap() succeeded!\n");
+		return;
+	}
+
+	assert(page_alloc(&pp, ALLOC_HIGH) == 0);
+	assert(page_alloc(&pp2, ALLOC_HIGH) == 0);
+	assert(page2pa(pp) >= MAXPA && page2pa(pp2) >= MAXPA);
+	va = kmap(pp);
+	assert((uintptr_t) va == KMAPBASE);
+	va2 = kmap(pp2);
+	assert((uintptr_t) va2 == KMAPBASE + PGSIZE);
+	va[0] = 0x12345678;
+	va[PGSIZE / 4 - 1] = page2ppn(pp);
+	va2[0] = 0x87654321;
+	assert(va[0] == 0x12345678);
+	kunmap(va2);
+	kunmap(va);
+
+	// the first slot again, for the other page
+	va2 = kmap(pp2);
+	assert((uintptr_t) va2 == KMAPBASE && va2[0] == 0x87654321);
+	kunmap(va2);
+	va = kmap(pp);
+	assert(va[0] == 0x12345678 && va[PGSIZE / 4 - 1] == page2ppn(pp));
+	kunmap(va);
+	assert(kmap_depth == 0);
+
+	page_free(pp);
+	page_free(pp2);
+	cprintf("check_kmap() succeeded!\n");
+}
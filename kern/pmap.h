@@ -0,0 +1,128 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/multiboot.h>
+#include <inc/assert.h>
+
+extern struct Page *pages;
+extern size_t npage;		// pages of physical memory
+extern physaddr_t maxpa;	// end of the highest usable memory
+
+// Physical memory below this is mapped at KERNBASE.  With PAE, there
+// can be more above it, which the kernel can get at only with kmap.
+#define MAXPA	(0xFFFFFFFF - KERNBASE + 1)
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address.
+ */
+#define PADDR(kva)						\
+({								\
+	uintptr_t __m_kva = (uintptr_t) (kva);			\
+	if (__m_kva < KERNBASE)					\
+		panic("PADDR called with invalid kva %08lx", __m_kva);\
+	(physaddr_t) (__m_kva - KERNBASE);			\
+})
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address, or
+ * one above MAXPA, which KERNBASE doesn't map. */
+#define KADDR(pa)						\
+({								\
+	physaddr_t __m_pa = (pa);				\
+	uint32_t __m_ppn = PPN(__m_pa);				\
+	if (__m_ppn >= npage || __m_pa >= MAXPA)		\
+		panic("KADDR called with invalid pa %08llx",	\
+		      (uint64_t) __m_pa);				\
+	(void*) (uintptr_t) (__m_pa + KERNBASE);		\
+})
+
+// Largest block page_alloc_order hands out: 2^10 pages, 4MB
+#define PAGE_MAXORDER	10
+
+// Order of the block a page directory takes: 1 page, or 4 with PAE
+#define PGDIR_ORDER	(NPDENTRIES * sizeof(pde_t) > PGSIZE ? 2 : 0)
+
+// Flags for page_alloc and page_alloc_order
+#define ALLOC_ZERO	0x1	// zero the page, from the pre-zeroed pool if we can
+#define ALLOC_HIGH	0x2	// may be above MAXPA: the kernel will use kmap
+
+void	i386_detect_memory(struct multiboot_info *mbi);
+void	page_init(void);
+int	page_alloc(struct Page **pp_store, int alloc_flags);
+int	page_alloc_order(struct Page **pp_store, int order, int alloc_flags);
+void	page_free(struct Page *pp);
+void	page_decref(struct Page *pp);
+size_t	page_nfree(void);
+bool	page_have_block(int order, int alloc_flags);
+void	page_split(struct Page *pp);
+void	*kmap(struct Page *pp);
+void	kunmap(void *va);
+void	page_zero_idle(void);
+
+// A batch of TLB invalidations for one address space, collected while
+// editing its page tables and carried out at once by tlb_gather_commit:
+// with one invlpg per page for a few pages, or by flushing the whole
+// TLB for more than tlb_flush_ceiling.  Pages unmapped along the way go
+// back only after that, so no stale TLB entry can reach a page in reuse.
+#define TLB_GATHER_MAX	64
+
+struct tlb_gather {
+	pde_t *tg_pgdir;
+	uint32_t tg_n;			// pages gathered
+	bool tg_kernel;			// any above UTOP (mapped everywhere)?
+	uintptr_t tg_va[TLB_GATHER_MAX];
+	struct Page_list tg_free;	// to free once the TLB is clean
+};
+
+extern uint32_t tlb_flush_ceiling;
+extern uint32_t tlb_ninvlpg, tlb_nflush, tlb_nflush_global;
+
+void	tlb_gather_init(struct tlb_gather *tg, pde_t *pgdir);
+void	tlb_gather_add(struct tlb_gather *tg, void *va);
+void	tlb_gather_decref(struct tlb_gather *tg, struct Page *pp);
+void	tlb_gather_commit(struct tlb_gather *tg);
+
+pte_t	*pgdir_walk(pde_t *pgdir, const void *va, int create);
+int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
+void	page_remove(pde_t *pgdir, void *va);
+struct Page *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
+void	tlb_invalidate(pde_t *pgdir, void *va);
+physaddr_t pgdir_cr3(pde_t *pgdir);
+
+static inline ppn_t
+page2ppn(struct Page *pp)
+{
+	return pp - pages;
+}
+
+static inline physaddr_t
+page2pa(struct Page *pp)
+{
+	return (physaddr_t) page2ppn(pp) << PGSHIFT;
+}
+
+static inline struct Page*
+pa2page(physaddr_t pa)
+{
+	if (PPN(pa) >= npage)
+		panic("pa2page called with invalid pa");
+	return &pages[PPN(pa)];
+}
+
+// The kernel virtual address of 'pp', which must be below MAXPA; see
+// kmap for pages that may not be.
+static inline void*
+page2kva(struct Page *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
@@ -0,0 +1,107 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+#include <inc/assert.h>
+
+#include <kern/swap.h>
+#include <kern/ide.h>
+#include <kern/init.h>
+#include <kern/malloc.h>
+
+/*
+ * The swap area is a run of page-sized slots on the boot disk, right
+ * after the kernel image, where the kernel puts anonymous pages it
+ * takes back under memory pressure (kern/vm.c).  kern/Makefrag marks
+ * it with a header sector holding SWAP_MAGIC, which is also slot 0, so
+ * slot numbers start at 1 and 0 can mean "no slot".
+ *
+ * We only swap to an IDE disk, through kern/ide.c, and only if our own
+ * boot loader loaded us and so told us where the kernel image ends.
+ */
+
+#define SWAP_MAGIC	"JOSSWAP"
+#define SLOTSECT	(PGSIZE / SECTSIZE)	// sectors per slot
+#define SWAP_MAXSLOT	65536			// 256MB of swap at most
+
+uint32_t swap_nslot;
+uint32_t swap_nused;
+uint32_t swap_nin, swap_nout;
+
+static uint32_t swap_start;	// first sector: the header, slot 0
+static uint32_t *swap_map;	// bit set if the slot is free
+static uint32_t swap_next;	// where to start looking for a free slot
+
+// Find the swap area, if there is one, and set up the slot bitmap.
+void
+swap_init(void)
+{
+	char hdr[SECTSIZE];
+	uint32_t nsect, i;
+
+	if (!bootinfo || bootinfo->bi_disk == BOOTDISK_VIRTIO)
+		return;
+	swap_start = bootinfo->bi_kimgend;
+	if ((nsect = ide_nsect()) <= swap_start + SLOTSECT
+	    || ide_read(swap_start, hdr, 1) < 0
+	    || memcmp(hdr, SWAP_MAGIC, sizeof(SWAP_MAGIC)) != 0)
+		return;
+
+	swap_nslot = MIN((nsect - swap_start) / SLOTSECT, SWAP_MAXSLOT);
+	if ((swap_map = malloc(ROUNDUP(swap_nslot, 32) / 8)) == NULL) {
+		swap_nslot = 0;
+		return;
+	}
+	memset(swap_map, 0, ROUNDUP(swap_nslot, 32) / 8);
+	for (i = 0; i < swap_nslot; i++)
+		swap_map[i / 32] |= 1 << (i % 32);
+	swap_map[0] &= ~1;		// the header
+	swap_next = 1;
+	cprintf("Swap: %dK at sector %d\n", (swap_nslot - 1) * PGSIZE / 1024,
+		swap_start);
+}
+
+// Allocate a slot.  Returns its number, or -E_NO_DISK if there are none.
+int
+swap_alloc(void)
+{
+	uint32_t i, w, n = ROUNDUP(swap_nslot, 32) / 32;
+
+	for (i = 0; i < n; i++) {
+		w = (swap_next / 32 + i) % n;
+		if (swap_map[w]) {
+			swap_next = w * 32 + __builtin_ctz(swap_map[w]);
+			swap_map[w] &= ~(1 << (swap_next % 32));
+			swap_nused++;
+			return swap_next;
+		}
+	}
+	return -E_NO_DISK;
+}
+
+void
+swap_free(uint32_t slot)
+{
+	assert(slot > 0 && slot < swap_nslot);
+	assert(!(swap_map[slot / 32] & (1 << (slot % 32))));
+	swap_map[slot / 32] |= 1 << (slot % 32);
+	swap_nused--;
+}
+
+// Read the page in 'slot' into the page at 'kva'.
+int
+swap_in(uint32_t slot, void *kva)
+{
+	swap_nin++;
+	return ide_read(swap_start + slot * SLOTSECT, kva, SLOTSECT);
+}
+
+// Write the page at 'kva' to 'slot'.
+int
+swap_out(uint32_t slot, const void *kva)
+{
+	swap_nout++;
+	return ide_write(swap_start + slot * SLOTSECT, kva, SLOTSECT);
+}
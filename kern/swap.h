@@ -0,0 +1,22 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SWAP_H
+#define JOS_KERN_SWAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Swap statistics, for vmstat
+extern uint32_t swap_nslot;		// page slots in the swap area
+extern uint32_t swap_nused;		// slots holding a page
+extern uint32_t swap_nin, swap_nout;	// pages read and written
+
+void swap_init(void);
+int swap_alloc(void);
+void swap_free(uint32_t slot);
+int swap_in(uint32_t slot, void *kva);
+int swap_out(uint32_t slot, const void *kva);
+
+#endif	// !JOS_KERN_SWAP_H
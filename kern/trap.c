@@ -0,0 +1,86 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/error.h>
+
+#include <kern/trap.h>
+#include <kern/pmap.h>
+#include <kern/vm.h>
+
+// The page of the user exception stack in 'pgdir', brought in and made
+// writable by the process if need be, and its page table entry; or
+// NULL if the process has none.
+static struct Page *
+uxstack_page(pde_t *pgdir, pte_t **pte_store)
+{
+	void *va = (void *) (UXSTACKTOP - PGSIZE);
+	struct Page *pp;
+
+	pp = page_lookup(pgdir, va, pte_store);
+	if (pp && (**pte_store & (PTE_W|PTE_U)) == (PTE_W|PTE_U))
+		return pp;
+	if (vm_fault(pgdir, (uintptr_t) va, FEC_WR|FEC_U) < 0)
+		return NULL;
+	return page_lookup(pgdir, va, pte_store);
+}
+
+//
+// Handle a page fault at 'fault_va' taken in user mode, whose trap-time
+// state is in 'tf', in the address space 'pgdir'.  If vm_fault can't fix
+// it and the process set up a handler at 'upcall', push a UTrapframe on
+// the user exception stack and change 'tf' to run the handler there.
+// The handler's entry code (lib/pfentry.S) resumes the faulting code by
+// itself, without entering the kernel again.
+//
+// A fault in the handler is on the exception stack already, so the new
+// frame goes below the trap-time %esp, leaving a word for the entry code
+// to push the return address into.
+//
+// The frame is written through a kernel mapping of the page (kmap), so
+// 'pgdir' needn't be the one in use.
+//
+// RETURNS
+//   0 -- the fault was fixed, or 'tf' will run the handler
+//   -E_FAULT -- no handler, or no room on the exception stack for it
+//   < 0 -- otherwise, from vm_fault
+//
+int
+page_fault_upcall(pde_t *pgdir, struct Trapframe *tf, uintptr_t fault_va,
+		  uintptr_t upcall)
+{
+	struct UTrapframe *utf;
+	struct Page *pp;
+	uintptr_t top;
+	pte_t *pte;
+	int r;
+
+	if ((r = vm_fault(pgdir, fault_va, tf->tf_err)) != -E_FAULT)
+		return r;
+	if (upcall == 0)
+		return -E_FAULT;
+
+	if (tf->tf_esp >= UXSTACKTOP - PGSIZE && tf->tf_esp < UXSTACKTOP)
+		top = tf->tf_esp - 4;
+	else
+		top = UXSTACKTOP;
+	if (top - sizeof(struct UTrapframe) < UXSTACKTOP - PGSIZE
+	    || (pp = uxstack_page(pgdir, &pte)) == NULL)
+		return -E_FAULT;
+
+	top -= sizeof(struct UTrapframe);
+	utf = (struct UTrapframe *) ((char *) kmap(pp) + PGOFF(top));
+	utf->utf_fault_va = fault_va;
+	utf->utf_err = tf->tf_err;
+	utf->utf_regs = tf->tf_regs;
+	utf->utf_eip = tf->tf_eip;
+	utf->utf_eflags = tf->tf_eflags;
+	utf->utf_esp = tf->tf_esp;
+	kunmap(ROUNDDOWN(utf, PGSIZE));
+	// The processor didn't see this write: mark it for the reclaimer.
+	*pte |= PTE_A | PTE_D;
+
+	tf->tf_eip = upcall;
+	tf->tf_esp = top;
+	return 0;
+}
@@ -0,0 +1,15 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRAP_H
+#define JOS_KERN_TRAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/memlayout.h>
+
+int page_fault_upcall(pde_t *pgdir, struct Trapframe *tf, uintptr_t fault_va,
+		      uintptr_t upcall);
+
+#endif /* JOS_KERN_TRAP_H */
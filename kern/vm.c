@@ -0,0 +1,1323 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/vm.h>
+#include <kern/pmap.h>
+#include <kern/swap.h>
+#include <kern/ksm.h>
+
+/*
+ * Anonymous memory: pages that start out zero, get memory only when
+ * they're first touched, and can be taken back under memory pressure
+ * by writing them to swap.
+ *
+ * vm_map_anon marks a range of an address space PTE_ANON without giving
+ * it any memory.  The page fault handler passes faults on to vm_fault,
+ * which maps a zeroed page there, or reads the page back from swap if
+ * the entry says PTE_SWAP.
+ *
+ * Each anonymous page mapped in exactly one place is on the reclaim
+ * list (PP_ANON), and its struct Page says where it's mapped.  When the
+ * page allocator runs dry, it calls vm_reclaim, which sweeps a CLOCK
+ * hand around the list.  A page whose PTE_A is set was used since the
+ * hand last came by, so it gets a second chance with PTE_A cleared; one
+ * whose PTE_A is still clear goes to swap.  A page read in from swap
+ * that hasn't been written since (no PTE_D) still has its copy there,
+ * and is simply dropped.
+ *
+ * A page mapped PTE_COW is shared, and stays in memory.  The first
+ * write to it through a given mapping faults, and vm_fault gives that
+ * mapping a copy of its own -- or, if no other mapping is left, just
+ * lets it write.  vm_fork uses this to copy an address space without
+ * copying any pages.  The pages it shares (PP_SHARED) are mapped at the
+ * same address in every address space that has them, so when all but
+ * one of the mappings are gone, vm_page_unshare can find the last one
+ * by looking in each address space, make it writable again if it was
+ * copy-on-write, and put the page back on the reclaim list.
+ *
+ * Anonymous memory that covers all of a page table gets a superpage if
+ * there's a free block for it: PTSIZE bytes mapped by the page directory
+ * entry (PTE_PS), taking one TLB entry instead of NPTENTRIES.  That's
+ * NPTENTRIES pages of memory, though, so it waits for vm_huge_min of
+ * them to be touched; the fault after that copies them into the
+ * superpage and zeroes the rest.  The page table it replaces is
+ * kept for when the superpage has to be split back into pages: before
+ * vm_fork shares them, when part of it is unmapped, when the reclaimer
+ * runs out of other pages to swap out, and when pgdir_walk is asked
+ * for a page table entry to change in it.
+ *
+ * A zero-fill fault that continues a sequential run of them through an
+ * address space (a stream) also maps a window of the pages after it,
+ * so a process going through fresh memory in order faults once per
+ * window instead of once per page.  The window doubles while all the
+ * pages mapped ahead get used (their PTE_A is set by the next fault in
+ * the stream, or was when the reclaimer cleared it), and halves when
+ * fewer than half of them do.  A stream starts with the second of two
+ * faults in a row; a fault that continues nothing is only remembered,
+ * so scattered faults don't push out the streams there are.
+ */
+
+// Superpages are blocks of this order, PTSIZE bytes
+#define HUGE_ORDER	(PTSHIFT - PGSHIFT)
+
+// How many pages of a page table have to be in before a fault there
+// makes it a superpage.  With 0, the first touch does, which saves the
+// most faults but zeroes and holds NPTENTRIES pages for what may be one
+// used; the default holds at most twice what's used.  Above NPTENTRIES,
+// there are no superpages.
+uint32_t vm_huge_min = NPTENTRIES / 2;
+
+#define NSTREAM		8	// sequential fault streams tracked
+#define AROUND_MAX	16	// most pages a fault maps ahead
+#define AROUND_RESERVE	256	// free pages mapping ahead leaves alone
+
+struct Stream {
+	pde_t *st_pgdir;
+	uintptr_t st_next;	// the fault that would continue it
+	uintptr_t st_ahead;	// the pages its last fault mapped ahead
+	uint32_t st_nahead;
+	uint32_t st_window;	// how many to map ahead next time
+	uint32_t st_used;	// ahead pages whose PTE_A vm_reclaim cleared
+};
+
+struct Fault {
+	pde_t *f_pgdir;
+	uintptr_t f_va;
+};
+
+static struct Page_list clock_list;
+static struct Page *clock_hand;		// next page to look at, or NULL
+static uint32_t nresident;		// pages on clock_list
+static struct Page_list huge_list;	// superpages mapped
+static uint32_t nhugeresident;		// superpages on huge_list
+static struct Stream streams[NSTREAM];
+static struct Page_list pgdir_list;	// address spaces, by the first
+					// page of each page directory
+static uint32_t stream_victim;		// next to replace, round robin
+static struct Fault lone[NSTREAM];	// recent faults in no stream
+static uint32_t lone_next;		// next to replace, round robin
+
+// Statistics, for vmstat
+static uint32_t nzfod;			// faults filled with zeroes
+static uint32_t nswapin;		// faults read back from swap
+static uint32_t ncow;			// copy-on-write faults that copied
+static uint32_t ncowreuse;		// ... that found the page unshared
+static uint32_t nforkshare;		// pages vm_fork shared
+static uint32_t nunshare;		// ... back to one mapping
+static uint32_t nhuge;			// faults filled with a superpage
+static uint32_t nhugesplit;		// superpages split back into pages
+static uint32_t naround;		// pages mapped ahead of faults
+static uint32_t naroundused;		// ... then used: faults avoided
+static uint32_t nscan;			// pages the clock hand passed
+static uint32_t nreclaim;		// pages taken back
+static uint64_t reclaim_tsc;		// cycles spent in vm_reclaim
+
+void
+vm_init(void)
+{
+	LIST_INIT(&clock_list);
+	LIST_INIT(&huge_list);
+	LIST_INIT(&pgdir_list);
+	swap_init();
+}
+
+// Allocate a page directory for a new address space, with nothing
+// mapped below UTOP and the kernel mapped above, as in entry_pgdir.
+// With PAE, it comes with a page-directory-pointer table for %cr3
+// (see pgdir_cr3), on a page of its own in pp_free of the directory's
+// first page.
+int
+vm_pgdir_alloc(pde_t **pgdir_store)
+{
+	extern pde_t entry_pgdir[];
+	struct Page *pp;
+	pde_t *pgdir;
+	int r;
+#ifdef JOS_PAE
+	struct Page *ptp;
+	pdpe_t *pdpt;
+	int i;
+#endif
+
+	if ((r = page_alloc_order(&pp, PGDIR_ORDER, 0)) < 0)
+		return r;
+#ifdef JOS_PAE
+	if ((r = page_alloc(&ptp, ALLOC_ZERO)) < 0) {
+		page_free(pp);
+		return r;
+	}
+	ptp->pp_ref = 1;
+	pdpt = page2kva(ptp);
+	for (i = 0; i < NPDPENTRIES; i++)
+		pdpt[i] = page2pa(pp + i) | PTE_P;
+	pp->pp_free = pdpt;
+#endif
+	pp->pp_ref = 1;
+	pp->pp_flags |= PP_PGDIR;
+	LIST_INSERT_HEAD(&pgdir_list, pp, pp_link);
+	pgdir = page2kva(pp);
+	memset(pgdir, 0, PDX(UTOP) * sizeof(pde_t));
+	memmove(&pgdir[PDX(UTOP)], &entry_pgdir[PDX(UTOP)],
+		(NPDENTRIES - PDX(UTOP)) * sizeof(pde_t));
+	*pgdir_store = pgdir;
+	return 0;
+}
+
+// Free everything mapped below UTOP in 'pgdir', its page tables, and
+// the page directory itself.  'pgdir' must not be in use.
+void
+vm_pgdir_free(pde_t *pgdir)
+{
+	struct Page *pp;
+	uint32_t pdeno, i;
+
+	for (i = 0; i < NSTREAM; i++) {
+		if (streams[i].st_pgdir == pgdir)
+			streams[i].st_pgdir = NULL;
+		if (lone[i].f_pgdir == pgdir)
+			lone[i].f_pgdir = NULL;
+	}
+	vm_unmap(pgdir, 0, UTOP);
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++)
+		if (pgdir[pdeno] & PTE_P) {
+			page_decref(pa2page(PTE_ADDR(pgdir[pdeno])));
+			pgdir[pdeno] = 0;
+		}
+	pp = pa2page(PADDR(pgdir));
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_PGDIR;
+#ifdef JOS_PAE
+	page_decref(pa2page(PADDR(pp->pp_free)));
+	pp->pp_free = NULL;
+#endif
+	page_decref(pp);
+}
+
+// Reserve [va, va+len) in 'pgdir', which must be page aligned and
+// below UTOP, for anonymous memory with permissions 'perm' (PTE_W and
+// PTE_U).  Anything mapped there before is unmapped.
+int
+vm_map_anon(pde_t *pgdir, uintptr_t va, size_t len, int perm)
+{
+	uintptr_t end = va + len;
+	pte_t *pte;
+
+	if (PGOFF(va) || PGOFF(len) || end < va || end > UTOP
+	    || (perm & ~(PTE_W|PTE_U)))
+		return -E_INVAL;
+	vm_unmap(pgdir, va, len);
+	for (; va < end; va += PGSIZE) {
+		if ((pte = pgdir_walk(pgdir, (void *) va, 1)) == NULL)
+			return -E_NO_MEM;
+		*pte = PTE_ANON | perm;
+	}
+	return 0;
+}
+
+// Unmap [va, va+len) in 'pgdir', giving back its pages and swap slots.
+// The pages go back once their TLB entries are gone.
+void
+vm_unmap(pde_t *pgdir, uintptr_t va, size_t len)
+{
+	struct tlb_gather tg;
+	uintptr_t end = va + len;
+	struct Page *pp;
+	pte_t *pte;
+
+	tlb_gather_init(&tg, pgdir);
+	for (; va < end; va += PGSIZE) {
+		if ((pte = pgdir_walk(pgdir, (void *) va, 0)) == NULL) {
+			// no page table: skip to the next one
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
+		}
+		if (*pte & PTE_PS) {
+			pp = pa2page(PTE_ADDR(*pte));
+			if (va % PTSIZE == 0 && end - va >= PTSIZE) {
+				// All of it: put back its page table, empty.
+				memset(pp->pp_free, 0, PGSIZE);
+				*pte = PADDR(pp->pp_free) | PTE_P | PTE_W | PTE_U;
+				pp->pp_free = NULL;
+				tlb_gather_add(&tg, (void *) va);
+				tlb_gather_decref(&tg, pp);
+				va += PTSIZE - PGSIZE;
+				continue;
+			}
+			vm_huge_split(pp);
+			pte = pgdir_walk(pgdir, (void *) va, 0);
+		}
+		if (*pte & PTE_P) {
+			pp = pa2page(PTE_ADDR(*pte));
+			*pte = 0;
+			tlb_gather_add(&tg, (void *) va);
+			tlb_gather_decref(&tg, pp);
+		} else if (*pte & PTE_SWAP)
+			swap_free(PTE_ADDR(*pte) >> PGSHIFT);
+		*pte = 0;
+	}
+	tlb_gather_commit(&tg);
+}
+
+static void
+clock_add(struct Page *pp, pde_t *pgdir, uintptr_t va)
+{
+	pp->pp_pgdir = pgdir;
+	pp->pp_va = va;
+	pp->pp_flags |= PP_ANON;
+	LIST_INSERT_HEAD(&clock_list, pp, pp_link);
+	nresident++;
+}
+
+// Take 'pp' off the reclaim list and let go of its copy in swap, or
+// stop sharing it for merged pages, or forget it was a superpage or
+// shared by vm_fork.  page_free calls this for pages that are any of
+// these.
+void
+vm_page_forget(struct Page *pp)
+{
+	pp->pp_flags &= ~PP_SHARED;
+	if (pp->pp_flags & PP_HUGE) {
+		LIST_REMOVE(pp, pp_link);
+		pp->pp_flags &= ~PP_HUGE;
+		nhugeresident--;
+		return;
+	}
+	ksm_forget(pp);
+	if (!(pp->pp_flags & PP_ANON))
+		return;
+	if (clock_hand == pp)
+		clock_hand = LIST_NEXT(pp, pp_link);
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_ANON;
+	nresident--;
+	if (pp->pp_swap) {
+		swap_free(pp->pp_swap);
+		pp->pp_swap = 0;
+	}
+}
+
+// If 'pgdir' maps the shared page 'pp', make that its one mapping.
+static bool
+unshare_in(struct Page *pp, pde_t *pgdir)
+{
+	pte_t *pte = pgdir_walk(pgdir, (void *) pp->pp_va, 0);
+
+	if (!pte || !(*pte & PTE_P) || (*pte & PTE_PS)
+	    || PTE_ADDR(*pte) != page2pa(pp))
+		return 0;
+	if (*pte & PTE_COW) {
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		tlb_invalidate(pgdir, (void *) pp->pp_va);
+	}
+	clock_add(pp, pgdir, pp->pp_va);
+	nunshare++;
+	return 1;
+}
+
+// The page 'pp', which vm_fork shared, has one mapping left: page_decref
+// calls this to make it an ordinary anonymous page again, writable if
+// it was copy-on-write, and on the reclaim list.
+//
+// There's no reverse map, so the mapping is found by walking address
+// spaces.  pp_pgdir still names the one the page was shared from, which
+// is where it's left when a child writes to it or exits, so that one
+// goes first, if it's still a page directory (PP_PGDIR).  Otherwise
+// this costs a page table walk per address space.
+void
+vm_page_unshare(struct Page *pp)
+{
+	pde_t *hint = pp->pp_pgdir;
+	struct Page *pdp;
+
+	pp->pp_flags &= ~PP_SHARED;
+	if (hint && (pa2page(PADDR(hint))->pp_flags & PP_PGDIR)
+	    && unshare_in(pp, hint))
+		return;
+	LIST_FOREACH(pdp, &pgdir_list, pp_link)
+		if (page2kva(pdp) != hint && unshare_in(pp, page2kva(pdp)))
+			return;
+}
+
+// The first page on the reclaim list, for walking it with
+// LIST_NEXT(pp, pp_link).
+struct Page *
+vm_anon_first(void)
+{
+	return LIST_FIRST(&clock_list);
+}
+
+// Map a superpage for a fault at 'va', whose entry is '*pte', if the
+// whole page table is anonymous memory with the same permissions, and
+// at least vm_huge_min of its pages are in.  Those are copied into the
+// superpage and freed; the rest of it is zeroed.  Pages that are shared
+// or out in swap rule it out.  Only free memory is worth it: this
+// doesn't reclaim.  Returns 0 if it mapped one.
+static int
+huge_fault(pde_t *pgdir, uintptr_t va, pte_t *pte)
+{
+	pte_t *pt = pte - PTX(va), perm = *pte & (PTE_W|PTE_U), used = 0;
+	uintptr_t base = ROUNDDOWN(va, PTSIZE);
+	struct tlb_gather tg;
+	struct Page *pp, *old;
+	uint32_t i, nin = 0;
+	void *src, *dst;
+
+	if (!(*pte & PTE_ANON) || vm_huge_min > NPTENTRIES)
+		return -E_INVAL;
+	for (i = 0; i < NPTENTRIES; i++) {
+		if (pt[i] == *pte)
+			continue;
+		if ((pt[i] & (PTE_P|PTE_W|PTE_U|PTE_COW)) != (PTE_P|perm))
+			return -E_INVAL;
+		old = pa2page(PTE_ADDR(pt[i]));
+		if ((old->pp_flags & (PP_ANON|PP_SHARED|PP_KSM)) != PP_ANON
+		    || old->pp_ref != 1)
+			return -E_INVAL;
+		nin++;
+	}
+	if (nin < vm_huge_min)
+		return -E_INVAL;
+	if (!page_have_block(HUGE_ORDER, ALLOC_HIGH)
+	    || page_alloc_order(&pp, HUGE_ORDER,
+				nin ? ALLOC_HIGH : ALLOC_ZERO|ALLOC_HIGH) < 0)
+		return -E_NO_MEM;
+
+	tlb_gather_init(&tg, pgdir);
+	for (i = 0; nin > 0 && i < NPTENTRIES; i++) {
+		dst = kmap(pp + i);
+		if (pt[i] & PTE_P) {
+			old = pa2page(PTE_ADDR(pt[i]));
+			src = kmap(old);
+			memmove(dst, src, PGSIZE);
+			kunmap(src);
+			used |= pt[i] & (PTE_A|PTE_D);
+			pt[i] = *pte;
+			tlb_gather_add(&tg, (void *) (base + i * PGSIZE));
+			tlb_gather_decref(&tg, old);
+		} else
+			memset(dst, 0, PGSIZE);
+		kunmap(dst);
+	}
+
+	pp->pp_ref = 1;
+	pp->pp_flags |= PP_HUGE;
+	pp->pp_pgdir = pgdir;
+	pp->pp_va = base;
+	pp->pp_free = pt;
+	LIST_INSERT_HEAD(&huge_list, pp, pp_link);
+	nhugeresident++;
+	pgdir[PDX(va)] = page2pa(pp) | perm | used | PTE_PS | PTE_P;
+	tlb_gather_add(&tg, (void *) va);
+	tlb_gather_commit(&tg);
+	nhuge++;
+	return 0;
+}
+
+// Break the superpage 'pp' back into pages, mapped by the page table
+// it replaced, each on the reclaim list.
+void
+vm_huge_split(struct Page *pp)
+{
+	pde_t *pgdir = pp->pp_pgdir;
+	uintptr_t va = pp->pp_va;
+	pte_t *pt = pp->pp_free;
+	pte_t perm = pgdir[PDX(va)] & (PTE_W|PTE_U|PTE_A|PTE_D);
+	uint32_t i;
+
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_HUGE;
+	pp->pp_free = NULL;
+	nhugeresident--;
+	page_split(pp);
+	for (i = 0; i < NPTENTRIES; i++) {
+		pp[i].pp_ref = 1;
+		pt[i] = page2pa(&pp[i]) | perm | PTE_P;
+		clock_add(&pp[i], pgdir, va + i * PGSIZE);
+	}
+	pgdir[PDX(va)] = PADDR(pt) | PTE_P | PTE_W | PTE_U;
+	tlb_invalidate(pgdir, (void *) va);
+	nhugesplit++;
+}
+
+// Give the mapping '*pte' of 'va' its own copy of the shared page it
+// maps, and let it write.
+static int
+cow_break(pde_t *pgdir, uintptr_t va, pte_t *pte)
+{
+	struct Page *pp, *old = pa2page(PTE_ADDR(*pte));
+	void *src, *dst;
+	int r;
+
+	if (old->pp_ref == 1) {
+		// Nobody else maps it any more, so it's ours to write.
+		ksm_forget(old);
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		tlb_invalidate(pgdir, (void *) va);
+		clock_add(old, pgdir, va);
+		ncowreuse++;
+		return 0;
+	}
+	if ((r = page_alloc(&pp, ALLOC_HIGH)) < 0)
+		return r;
+	src = kmap(old);
+	dst = kmap(pp);
+	memmove(dst, src, PGSIZE);
+	kunmap(dst);
+	kunmap(src);
+	pp->pp_ref = 1;
+	*pte = page2pa(pp) | (*pte & PTE_U) | PTE_W | PTE_P;
+	tlb_invalidate(pgdir, (void *) va);
+	clock_add(pp, pgdir, va);
+	page_decref(old);
+	ncow++;
+	return 0;
+}
+
+// vm_reclaim is about to clear PTE_A for 'va' in 'pgdir': if a stream
+// mapped the page ahead, note that it was used.
+static void
+stream_note_used(pde_t *pgdir, uintptr_t va)
+{
+	struct Stream *st;
+
+	for (st = streams; st < streams + NSTREAM; st++)
+		if (st->st_pgdir == pgdir && va >= st->st_ahead
+		    && va < st->st_ahead + st->st_nahead * PGSIZE)
+			st->st_used |= 1 << ((va - st->st_ahead) >> PGSHIFT);
+}
+
+// After a zero-fill fault at 'va', mapped by '*pte': if it continues a
+// stream, adjust the stream's window by how many of the pages it mapped
+// ahead last time were used, then map the next window of pages, as far
+// as they're untouched anonymous memory in the same page table.  If it
+// follows a recent fault that continued no stream, start one.
+static void
+fault_around(pde_t *pgdir, uintptr_t va, pte_t *pte)
+{
+	struct Stream *st;
+	struct Page *pp;
+	pte_t *apte;
+	uint32_t i, used = 0;
+
+	for (st = streams; st < streams + NSTREAM; st++)
+		if (st->st_pgdir == pgdir && st->st_next == va)
+			break;
+	if (st == streams + NSTREAM) {
+		for (i = 0; i < NSTREAM; i++)
+			if (lone[i].f_pgdir == pgdir
+			    && lone[i].f_va + PGSIZE == va)
+				break;
+		if (i == NSTREAM) {
+			lone[lone_next % NSTREAM].f_pgdir = pgdir;
+			lone[lone_next++ % NSTREAM].f_va = va;
+			return;
+		}
+		lone[i].f_pgdir = NULL;
+		st = &streams[stream_victim++ % NSTREAM];
+		st->st_pgdir = pgdir;
+		st->st_window = 2;
+	} else {
+		for (i = 0; i < st->st_nahead; i++) {
+			apte = pgdir_walk(pgdir,
+					  (void *) (st->st_ahead + i * PGSIZE), 0);
+			if ((st->st_used & (1 << i))
+			    || (apte && (*apte & (PTE_P|PTE_A)) == (PTE_P|PTE_A)))
+				used++;
+		}
+		naroundused += used;
+		if (used == st->st_nahead)
+			st->st_window = MIN(MAX(2 * st->st_window, 2), AROUND_MAX);
+		else if (used < st->st_nahead / 2)
+			st->st_window /= 2;
+	}
+
+	// Not worth reclaiming for, so stop short of that.
+	st->st_used = 0;
+	st->st_ahead = va + PGSIZE;
+	for (i = 0; i < st->st_window; i++) {
+		apte = pte + 1 + i;
+		if (PTX(va) + 1 + i >= NPTENTRIES
+		    || (*apte & (PTE_P|PTE_ANON)) != PTE_ANON
+		    || page_nfree() < AROUND_RESERVE
+		    || page_alloc(&pp, ALLOC_ZERO|ALLOC_HIGH) < 0)
+			break;
+		pp->pp_ref = 1;
+		*apte = page2pa(pp) | (*apte & (PTE_W|PTE_U)) | PTE_P;
+		clock_add(pp, pgdir, st->st_ahead + i * PGSIZE);
+	}
+	st->st_nahead = i;
+	st->st_next = va + (i + 1) * PGSIZE;
+	naround += i;
+}
+
+//
+// Handle a page fault at 'va' in the address space 'pgdir', with error
+// code 'err' (FEC_*), if it's in anonymous memory that isn't in yet, or
+// a write to a copy-on-write page.
+//
+// RETURNS
+//   0 -- the faulting instruction can be restarted
+//   -E_FAULT -- the fault isn't ours to fix
+//   < 0 -- otherwise, couldn't bring the page in
+//
+int
+vm_fault(pde_t *pgdir, uintptr_t va, uint32_t err)
+{
+	struct Page *pp;
+	uint32_t slot = 0;
+	void *kva;
+	pte_t *pte;
+	int r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (va >= UTOP || (pte = pgdir_walk(pgdir, (void *) va, 0)) == NULL
+	    || ((err & FEC_U) && !(*pte & PTE_U)))
+		return -E_FAULT;
+	if (*pte & PTE_P) {
+		if ((err & FEC_WR) && (*pte & PTE_COW))
+			return cow_break(pgdir, va, pte);
+		return -E_FAULT;
+	}
+	if (!(*pte & (PTE_ANON|PTE_SWAP)) || ((err & FEC_WR) && !(*pte & PTE_W)))
+		return -E_FAULT;
+	if (huge_fault(pgdir, va, pte) == 0)
+		return 0;
+
+	// Reclaiming to satisfy this can't touch *pte: it isn't present.
+	if ((r = page_alloc(&pp, *pte & PTE_SWAP ? ALLOC_HIGH
+			    : ALLOC_ZERO|ALLOC_HIGH)) < 0)
+		return r;
+	if (*pte & PTE_SWAP) {
+		slot = PTE_ADDR(*pte) >> PGSHIFT;
+		kva = kmap(pp);
+		r = swap_in(slot, kva);
+		kunmap(kva);
+		if (r < 0) {
+			page_free(pp);
+			return r;
+		}
+		pp->pp_swap = slot;
+		nswapin++;
+	} else
+		nzfod++;
+
+	pp->pp_ref = 1;
+	*pte = page2pa(pp) | (*pte & (PTE_W|PTE_U)) | PTE_P;
+	clock_add(pp, pgdir, va);
+	if (slot == 0)
+		fault_around(pgdir, va, pte);
+	return 0;
+}
+
+// Copy the address space below UTOP in 'src' to 'dst', which has
+// nothing mapped there yet.  Pages aren't copied, but shared: writable
+// ones become copy-on-write in both.  Pages out in swap get read back
+// in first, since only one page table entry can own a swap slot.
+int
+vm_fork(pde_t *dst, pde_t *src)
+{
+	struct tlb_gather tg;
+	struct Page *pp;
+	pte_t *spte, *dpte;
+	uintptr_t va;
+	int r = 0;
+
+	tlb_gather_init(&tg, src);
+	for (va = 0; va < UTOP; va += PGSIZE) {
+		if ((spte = pgdir_walk(src, (void *) va, 0)) == NULL) {
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
+		}
+		if (*spte & PTE_PS) {
+			// Sharing works a page at a time.
+			vm_huge_split(pa2page(PTE_ADDR(*spte)));
+			spte = pgdir_walk(src, (void *) va, 0);
+		}
+		if (*spte == 0)
+			continue;
+		// Allocate first: reclaiming can change *spte.
+		if ((dpte = pgdir_walk(dst, (void *) va, 1)) == NULL) {
+			r = -E_NO_MEM;
+			break;
+		}
+		if ((*spte & PTE_SWAP) && (r = vm_fault(src, va, 0)) < 0)
+			break;
+		if (!(*spte & PTE_P)) {
+			*dpte = *spte;
+			continue;
+		}
+
+		pp = pa2page(PTE_ADDR(*spte));
+		if (*spte & PTE_W) {
+			*spte = (*spte & ~PTE_W) | PTE_COW;
+			tlb_gather_add(&tg, (void *) va);
+		}
+		// Mapped twice now, so the reclaimer can't have it until
+		// vm_page_unshare gives it back.
+		if (pp->pp_flags & PP_ANON) {
+			vm_page_forget(pp);
+			pp->pp_flags |= PP_SHARED;
+		}
+		pp->pp_ref++;
+		*dpte = *spte;
+		nforkshare++;
+	}
+	tlb_gather_commit(&tg);
+	return r;
+}
+
+// Write 'pp', mapped by '*pte', to swap unless swap has it already,
+// then unmap it, leaving the TLB entry and freeing the page to 'tg'.
+static int
+page_evict(struct Page *pp, pte_t *pte, struct tlb_gather *tg)
+{
+	uint32_t slot = pp->pp_swap;
+	void *kva;
+	int r;
+
+	if (slot == 0) {
+		if ((r = swap_alloc()) < 0)
+			return r;
+		slot = r;
+	}
+	if (!pp->pp_swap || (*pte & PTE_D)) {
+		kva = kmap(pp);
+		r = swap_out(slot, kva);
+		kunmap(kva);
+		if (r < 0) {
+			if (!pp->pp_swap)
+				swap_free(slot);
+			return r;
+		}
+	}
+
+	// The slot now belongs to the page table entry.
+	pp->pp_swap = 0;
+	*pte = (slot << PGSHIFT) | PTE_SWAP | (*pte & (PTE_W|PTE_U));
+	tlb_gather_add(tg, (void *) pp->pp_va);
+	tlb_gather_decref(tg, pp);
+	return 0;
+}
+
+// Try to free 'npages' pages by sending anonymous pages to swap, going
+// around the reclaim list at most twice, splitting superpages when it
+// gets nothing more from that.  Returns how many it freed.  TLB entries
+// are gathered for one address space at a time: runs of pages on the
+// list usually come from the same one.
+int
+vm_reclaim(int npages)
+{
+	uint64_t start = read_tsc();
+	uint32_t n, maxscan = 2 * nresident;
+	struct tlb_gather tg;
+	struct Page *pp;
+	pte_t *pte;
+	int nfreed = 0;
+
+	tlb_gather_init(&tg, NULL);
+	for (n = 0; nfreed < npages; n++) {
+		if (n >= maxscan) {
+			if ((pp = LIST_FIRST(&huge_list)) == NULL)
+				break;
+			vm_huge_split(pp);
+			maxscan = n + 2 * nresident;
+		}
+		if (clock_hand == NULL
+		    && (clock_hand = LIST_FIRST(&clock_list)) == NULL)
+			break;
+		pp = clock_hand;
+		clock_hand = LIST_NEXT(pp, pp_link);
+
+		if (pp->pp_pgdir != tg.tg_pgdir) {
+			tlb_gather_commit(&tg);
+			tlb_gather_init(&tg, pp->pp_pgdir);
+		}
+		pte = pgdir_walk(pp->pp_pgdir, (void *) pp->pp_va, 0);
+		if (*pte & PTE_A) {
+			stream_note_used(pp->pp_pgdir, pp->pp_va);
+			*pte &= ~PTE_A;
+			tlb_gather_add(&tg, (void *) pp->pp_va);
+		} else if (page_evict(pp, pte, &tg) == 0)
+			nfreed++;
+	}
+	tlb_gather_commit(&tg);
+	nscan += n;
+	nreclaim += nfreed;
+	reclaim_tsc += read_tsc() - start;
+	return nfreed;
+}
+
+void
+vm_stat(void)
+{
+	cprintf("anonymous: %d pages resident\n", nresident);
+	cprintf("faults:    %d zero-filled, %d from swap\n", nzfod, nswapin);
+	cprintf("cow:       %d pages shared by fork, %d copied, %d reused, "
+		"%d unshared\n", nforkshare, ncow, ncowreuse, nunshare);
+	cprintf("huge:      %d superpages of %dKB mapped, %d made, %d split, "
+		"made at %d pages in\n", nhugeresident, PTSIZE / 1024, nhuge,
+		nhugesplit, vm_huge_min);
+	cprintf("ahead:     %d pages mapped ahead of faults, %d used "
+		"(faults avoided)\n", naround, naroundused);
+	cprintf("reclaim:   %d pages of %d scanned", nreclaim, nscan);
+	if (nreclaim)
+		cprintf(" (%d%%), %llu cycles/page", nreclaim * 100 / nscan,
+			reclaim_tsc / nreclaim);
+	cprintf("\n");
+	if (swap_nslot)
+		cprintf("swap:      %d of %d slots in use, %d pages in, %d out\n",
+			swap_nused, swap_nslot - 1, swap_nin, swap_nout);
+	else
+		cprintf("swap:      none\n");
+}
+
+// Start the vmstat counts over, as after the boot-time checks, whose
+// faults, reclaiming and swap I/O are nothing anyone asked for.
+void
+vm_stat_reset(void)
+{
+	nzfod = nswapin = 0;
+	ncow = ncowreuse = nforkshare = nunshare = 0;
+	nhuge = nhugesplit = 0;
+	naround = naroundused = 0;
+	nscan = nreclaim = 0;
+	reclaim_tsc = 0;
+	swap_nin = swap_nout = 0;
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+// Bring in the page at 'va' with a fault of type 'err', unless it is in.
+static void
+check_fault(pde_t *pgdir, uintptr_t va, uint32_t err)
+{
+	if (!page_lookup(pgdir, (void *) va, NULL))
+		assert(vm_fault(pgdir, va, err) == 0);
+	assert(page_lookup(pgdir, (void *) va, NULL));
+}
+
+// Mark the page at 'va' with 'v' in its first and last words.  Like
+// everything here, this goes through kmap, not the user mapping.
+static void
+check_fill(pde_t *pgdir, uintptr_t va, uint32_t v)
+{
+	uint32_t *p = kmap(page_lookup(pgdir, (void *) va, NULL));
+
+	p[0] = v;
+	p[PGSIZE / 4 - 1] = ~v;
+	kunmap(p);
+}
+
+// Is the page at 'va' marked with 'v'?
+static bool
+check_has(pde_t *pgdir, uintptr_t va, uint32_t v)
+{
+	uint32_t *p = kmap(page_lookup(pgdir, (void *) va, NULL));
+	bool ok = p[0] == v && p[PGSIZE / 4 - 1] == ~v;
+
+	kunmap(p);
+	return ok;
+}
+
+#define CHECK_NPAGE	16
+
+// Check anonymous memory in a scratch address space: zero-fill faults,
+// reclaim to swap and back (if there is swap), and unmapping.
+static void
+check_anon(void)
+{
+	size_t nfree0 = page_nfree(), nfree1;
+	uint32_t nused0 = swap_nused, *p;
+	uintptr_t va, base = UTEXT;
+	pde_t *pgdir;
+	pte_t *pte;
+	int i;
+
+	assert(vm_pgdir_alloc(&pgdir) == 0);
+	assert(vm_map_anon(pgdir, base, CHECK_NPAGE * PGSIZE,
+			   PTE_W|PTE_U) == 0);
+	nfree1 = page_nfree();
+
+	// vm_map_anon gives no memory, only the promise of zero pages
+	for (i = 0; i < CHECK_NPAGE; i++) {
+		pte = pgdir_walk(pgdir, (void *) (base + i * PGSIZE), 0);
+		assert(pte && *pte == (PTE_ANON|PTE_W|PTE_U));
+	}
+	assert(vm_fault(pgdir, base, FEC_U) == 0);
+	assert(page_nfree() < nfree1);
+	p = kmap(page_lookup(pgdir, (void *) base, NULL));
+	for (i = 0; i < PGSIZE / 4; i++)
+		assert(p[i] == 0);
+	kunmap(p);
+	// a fault on a page that's in isn't ours; nor is one outside
+	assert(vm_fault(pgdir, base, FEC_U) == -E_FAULT);
+	assert(vm_fault(pgdir, base + CHECK_NPAGE * PGSIZE, FEC_U)
+	       == -E_FAULT);
+
+	for (i = 0; i < CHECK_NPAGE; i++) {
+		va = base + i * PGSIZE;
+		check_fault(pgdir, va, FEC_U|FEC_WR);
+		check_fill(pgdir, va, va);
+	}
+	assert(page_nfree() == nfree1 - CHECK_NPAGE);
+
+	if (swap_nslot) {
+		// nothing has touched them through PTE_A, so all of them go
+		assert(vm_reclaim(CHECK_NPAGE) == CHECK_NPAGE);
+		assert(page_nfree() == nfree1);
+		assert(swap_nused == nused0 + CHECK_NPAGE);
+		for (i = 0; i < CHECK_NPAGE; i++) {
+			va = base + i * PGSIZE;
+			pte = pgdir_walk(pgdir, (void *) va, 0);
+			assert((*pte & (PTE_P|PTE_SWAP)) == PTE_SWAP);
+			assert(!page_lookup(pgdir, (void *) va, NULL));
+		}
+
+		// the same data comes back, and swap keeps a copy
+		for (i = 0; i < CHECK_NPAGE; i++) {
+			va = base + i * PGSIZE;
+			assert(vm_fault(pgdir, va, FEC_U) == 0);
+			assert(check_has(pgdir, va, va));
+			assert(page_lookup(pgdir, (void *) va, NULL)->pp_swap);
+		}
+		assert(page_nfree() == nfree1 - CHECK_NPAGE);
+		assert(swap_nused == nused0 + CHECK_NPAGE);
+	}
+
+	// unmapping gives back the pages and the swap slots
+	vm_unmap(pgdir, base, CHECK_NPAGE * PGSIZE);
+	assert(page_nfree() == nfree1);
+	assert(swap_nused == nused0);
+	for (i = 0; i < CHECK_NPAGE; i++)
+		assert(*pgdir_walk(pgdir, (void *) (base + i * PGSIZE), 0) == 0);
+
+	vm_pgdir_free(pgdir);
+	assert(page_nfree() == nfree0);
+}
+
+// Check vm_fork: pages shared copy-on-write, a write copying one, and
+// the pages going back on the reclaim list when the child is gone.
+static void
+check_fork(void)
+{
+	size_t nfree0 = page_nfree(), nfree1;
+	uint32_t nused0 = swap_nused, ncow0 = ncow, nres0 = nresident;
+	uintptr_t va, base = UTEXT, ro = UTEXT + 4 * PGSIZE;
+	struct Page *pp[5];
+	pde_t *parent, *child, *child2;
+	pte_t *pte;
+	int i;
+
+	// four writable pages, and a read-only one
+	assert(vm_pgdir_alloc(&parent) == 0);
+	assert(vm_map_anon(parent, base, 4 * PGSIZE, PTE_W|PTE_U) == 0);
+	assert(vm_map_anon(parent, ro, PGSIZE, PTE_U) == 0);
+	for (i = 0; i < 4; i++) {
+		va = base + i * PGSIZE;
+		check_fault(parent, va, FEC_U|FEC_WR);
+		check_fill(parent, va, va);
+	}
+	check_fault(parent, ro, FEC_U);
+	assert(vm_fault(parent, ro, FEC_U|FEC_WR) == -E_FAULT);
+	for (i = 0; i < 5; i++)
+		pp[i] = page_lookup(parent, (void *) (base + i * PGSIZE), NULL);
+	assert(nresident == nres0 + 5);
+	nfree1 = page_nfree();
+
+	// the child shares every page, and nothing can reclaim them
+	assert(vm_pgdir_alloc(&child) == 0);
+	assert(vm_fork(child, parent) == 0);
+	for (i = 0; i < 5; i++) {
+		va = base + i * PGSIZE;
+		assert(page_lookup(child, (void *) va, &pte) == pp[i]);
+		assert(pp[i]->pp_ref == 2);
+		assert((pp[i]->pp_flags & (PP_ANON|PP_SHARED)) == PP_SHARED);
+		assert(!(*pte & PTE_W));
+		assert(!(*pte & PTE_COW) == (va == ro));
+		assert(*pgdir_walk(parent, (void *) va, 0) == *pte);
+	}
+	assert(nresident == nres0);
+
+	// a write by the parent copies; the child's page is its own again
+	assert(vm_fault(parent, base, FEC_U|FEC_WR) == 0);
+	assert(ncow == ncow0 + 1);
+	assert(page_lookup(parent, (void *) base, &pte) != pp[0]);
+	assert((*pte & (PTE_W|PTE_COW)) == PTE_W);
+	assert(check_has(parent, base, base));
+	assert(page_lookup(child, (void *) base, &pte) == pp[0]);
+	assert((*pte & (PTE_W|PTE_COW)) == PTE_W);
+	assert(pp[0]->pp_ref == 1 && (pp[0]->pp_flags & PP_ANON));
+	assert(pp[0]->pp_pgdir == child && pp[0]->pp_va == base);
+	assert(vm_fault(child, base, FEC_U|FEC_WR) == -E_FAULT);
+	assert(check_has(child, base, base));
+
+	// with the child gone, the parent's pages are all its own again:
+	// writable without a copy, and on the reclaim list
+	vm_pgdir_free(child);
+	for (i = 1; i < 5; i++) {
+		va = base + i * PGSIZE;
+		assert(page_lookup(parent, (void *) va, &pte) == pp[i]);
+		assert(pp[i]->pp_ref == 1);
+		assert((pp[i]->pp_flags & (PP_ANON|PP_SHARED)) == PP_ANON);
+		assert(pp[i]->pp_pgdir == parent && pp[i]->pp_va == va);
+		assert(!(*pte & PTE_COW));
+		assert(!(*pte & PTE_W) == (va == ro));
+		assert(check_has(parent, va, va) || va == ro);
+	}
+	assert(ncow == ncow0 + 1);
+	assert(nresident == nres0 + 5);
+	assert(page_nfree() == nfree1);
+	if (swap_nslot) {
+		assert(vm_reclaim(5) == 5);
+		assert(swap_nused == nused0 + 5);
+	}
+
+	// Shared three ways, with the address space it was shared from
+	// gone first: the last one left still gets it back.
+	assert(vm_pgdir_alloc(&child) == 0);
+	assert(vm_pgdir_alloc(&child2) == 0);
+	check_fault(parent, base, FEC_U|FEC_WR);
+	pp[0] = page_lookup(parent, (void *) base, NULL);
+	assert(vm_fork(child, parent) == 0 && vm_fork(child2, parent) == 0);
+	assert(pp[0]->pp_ref == 3 && pp[0]->pp_pgdir == parent);
+	vm_pgdir_free(parent);
+	vm_pgdir_free(child);
+	assert(page_lookup(child2, (void *) base, &pte) == pp[0]);
+	assert(pp[0]->pp_ref == 1 && (pp[0]->pp_flags & PP_ANON));
+	assert(pp[0]->pp_pgdir == child2 && (*pte & PTE_W));
+	assert(check_has(child2, base, base));
+
+	vm_pgdir_free(child2);
+	assert(page_nfree() == nfree0);
+	assert(swap_nused == nused0);
+	assert(nresident == nres0);
+}
+
+// Map [base, base+PTSIZE) in 'pgdir' anonymous and fault in the
+// superpage that covers it, which this returns.
+static struct Page *
+check_huge_map(pde_t *pgdir, uintptr_t base)
+{
+	uint32_t nhuge0 = nhuge;
+	struct Page *pp;
+
+	assert(vm_map_anon(pgdir, base, PTSIZE, PTE_W|PTE_U) == 0);
+	assert(vm_fault(pgdir, base + 3 * PGSIZE, FEC_U|FEC_WR) == 0);
+	assert(nhuge == nhuge0 + 1);
+	assert((pgdir[PDX(base)] & (PTE_P|PTE_PS|PTE_W)) == (PTE_P|PTE_PS|PTE_W));
+	pp = page_lookup(pgdir, (void *) base, NULL);
+	assert(pp && (pp->pp_flags & PP_HUGE) && pp->pp_order == HUGE_ORDER);
+	assert(pp->pp_ref == 1 && pp->pp_pgdir == pgdir && pp->pp_va == base);
+	assert(page_lookup(pgdir, (void *) (base + 5 * PGSIZE), NULL) == pp + 5);
+	return pp;
+}
+
+// Has the superpage at 'base' been split into pages, each on the
+// reclaim list?
+static bool
+check_huge_split(pde_t *pgdir, uintptr_t base, struct Page *pp)
+{
+	pte_t *pte = pgdir_walk(pgdir, (void *) base, 0);
+	uint32_t i;
+
+	if (pgdir[PDX(base)] & PTE_PS)
+		return 0;
+	for (i = 0; i < NPTENTRIES; i++)
+		if ((pte[i] & PTE_P) && (pa2page(PTE_ADDR(pte[i])) != pp + i
+					 || pp[i].pp_order != 0
+					 || !(pp[i].pp_flags & (PP_ANON|PP_SHARED))))
+			return 0;
+	return !(pp->pp_flags & PP_HUGE);
+}
+
+// Check superpages: making one once enough of its pages are in, or on
+// the first fault, unmapping all of one, and splitting one for a
+// partial unmap, fork, page_insert, page_remove and the reclaimer.
+// Needs a free block of PTSIZE.
+static void
+check_huge(void)
+{
+	size_t nfree0 = page_nfree(), nfree1;
+	uint32_t nused0 = swap_nused, nsplit0 = nhugesplit;
+	uint32_t nres0 = nresident, nhugeres0 = nhugeresident;
+	uint32_t huge_min0 = vm_huge_min;
+	uintptr_t base = UTEXT;
+	struct Page *pp, *pp2;
+	pde_t *pgdir, *child;
+	pte_t *pte;
+	uint32_t *p;
+	int i;
+
+	if (!page_have_block(HUGE_ORDER, ALLOC_HIGH))
+		return;
+	assert(vm_pgdir_alloc(&pgdir) == 0);
+	assert(vm_map_anon(pgdir, base, PTSIZE, PTE_W|PTE_U) == 0);
+	nfree1 = page_nfree();
+
+	// Pages come in one at a time until vm_huge_min of them are; the
+	// fault after that copies them into a superpage and frees them.
+	vm_huge_min = NPTENTRIES + 1;
+	for (i = 0; i < 4; i++) {
+		check_fault(pgdir, base + i * PGSIZE, FEC_U|FEC_WR);
+		check_fill(pgdir, base + i * PGSIZE, i + 1);
+	}
+	assert(!(pgdir[PDX(base)] & PTE_PS));
+	vm_huge_min = 4;
+	assert(vm_fault(pgdir, base + 100 * PGSIZE, FEC_U|FEC_WR) == 0);
+	assert((pgdir[PDX(base)] & (PTE_P|PTE_PS|PTE_W)) == (PTE_P|PTE_PS|PTE_W));
+	pp = page_lookup(pgdir, (void *) base, NULL);
+	assert(pp && (pp->pp_flags & PP_HUGE) && pp->pp_order == HUGE_ORDER);
+	for (i = 0; i < 4; i++)
+		assert(check_has(pgdir, base + i * PGSIZE, i + 1));
+	p = kmap(pp + 100);
+	assert(p[0] == 0 && p[PGSIZE / 4 - 1] == 0);
+	kunmap(p);
+	assert(page_nfree() == nfree1 - NPTENTRIES);
+	assert(nresident == nres0 && nhugeresident == nhugeres0 + 1);
+	vm_unmap(pgdir, base, PTSIZE);
+	assert(page_nfree() == nfree1);
+	assert(vm_map_anon(pgdir, base, PTSIZE, PTE_W|PTE_U) == 0);
+	vm_huge_min = 0;
+
+	// one fault maps all of it, zeroed, and unmapping it all takes no
+	// split
+	pp = check_huge_map(pgdir, base);
+	assert(page_nfree() == nfree1 - NPTENTRIES);
+	assert(nhugeresident == nhugeres0 + 1 && nresident == nres0);
+	for (i = 0; i < NPTENTRIES; i += NPTENTRIES / 8) {
+		p = kmap(pp + i);
+		assert(p[0] == 0 && p[PGSIZE / 4 - 1] == 0);
+		kunmap(p);
+	}
+	vm_unmap(pgdir, base, PTSIZE);
+	assert(nhugesplit == nsplit0 && nhugeresident == nhugeres0);
+	assert(page_nfree() == nfree1);
+	assert(*pgdir_walk(pgdir, (void *) base, 0) == 0);
+
+	// unmapping part of it splits it
+	pp = check_huge_map(pgdir, base);
+	check_fill(pgdir, base + 7 * PGSIZE, 7);
+	vm_unmap(pgdir, base, PGSIZE);
+	assert(nhugesplit == ++nsplit0);
+	assert(check_huge_split(pgdir, base, pp));
+	assert(!page_lookup(pgdir, (void *) base, NULL));
+	assert(check_has(pgdir, base + 7 * PGSIZE, 7));
+	assert(nresident == nres0 + NPTENTRIES - 1);
+	assert(page_nfree() == nfree1 - NPTENTRIES + 1);
+
+	// so does forking
+	pp = check_huge_map(pgdir, base);
+	assert(nresident == nres0);
+	assert(vm_pgdir_alloc(&child) == 0);
+	assert(vm_fork(child, pgdir) == 0);
+	assert(nhugesplit == ++nsplit0);
+	assert(check_huge_split(pgdir, base, pp));
+	assert(page_lookup(child, (void *) (base + 9 * PGSIZE), NULL) == pp + 9);
+	assert(pp[9].pp_ref == 2);
+	vm_pgdir_free(child);
+	assert(pp[9].pp_ref == 1 && (pp[9].pp_flags & PP_ANON));
+
+	// and changing one page with page_insert or page_remove
+	pp = check_huge_map(pgdir, base);
+	assert(page_alloc(&pp2, 0) == 0);
+	assert(page_insert(pgdir, pp2, (void *) (base + PGSIZE),
+			   PTE_W|PTE_U) == 0);
+	assert(nhugesplit == ++nsplit0);
+	assert(pp2->pp_ref == 1 && pp[1].pp_ref == 0);
+	assert(page_lookup(pgdir, (void *) (base + PGSIZE), NULL) == pp2);
+	assert(page_lookup(pgdir, (void *) base, NULL) == pp);
+	page_remove(pgdir, (void *) (base + PGSIZE));
+	assert(!page_lookup(pgdir, (void *) (base + PGSIZE), NULL));
+
+	pp = check_huge_map(pgdir, base);
+	page_remove(pgdir, (void *) (base + 2 * PGSIZE));
+	assert(nhugesplit == ++nsplit0);
+	assert(!page_lookup(pgdir, (void *) (base + 2 * PGSIZE), NULL));
+	assert(page_lookup(pgdir, (void *) (base + 3 * PGSIZE), &pte) == pp + 3);
+	assert(!(*pte & PTE_PS));
+	assert(page_nfree() == nfree1 - NPTENTRIES + 1);
+
+	// and the reclaimer, when there's nothing else to take
+	pp = check_huge_map(pgdir, base);
+	assert(nresident == nres0);
+	if (swap_nslot) {
+		assert(vm_reclaim(1) == 1);
+		assert(nhugesplit == ++nsplit0);
+		assert(check_huge_split(pgdir, base, pp));
+		assert(nresident == nres0 + NPTENTRIES - 1);
+		assert(swap_nused == nused0 + 1);
+	}
+
+	vm_pgdir_free(pgdir);
+	assert(page_nfree() == nfree0);
+	assert(swap_nused == nused0);
+	assert(nresident == nres0 && nhugeresident == nhugeres0);
+	vm_huge_min = huge_min0;
+}
+
+// Set PTE_A, as the processor does on a use, on the pages in 'pgdir'
+// from page 'first' to 'last' after 'base' that are in.
+static void
+check_use(pde_t *pgdir, uintptr_t base, int first, int last)
+{
+	pte_t *pte;
+
+	for (; first <= last; first++)
+		if (page_lookup(pgdir, (void *) (base + first * PGSIZE), &pte))
+			*pte |= PTE_A;
+}
+
+// Is each page from 'first' to 'last' after 'base' in?
+static bool
+check_in(pde_t *pgdir, uintptr_t base, int first, int last)
+{
+	for (; first <= last; first++)
+		if (!page_lookup(pgdir, (void *) (base + first * PGSIZE), NULL))
+			return 0;
+	return 1;
+}
+
+// Check mapping ahead of sequential faults: a stream starts on the
+// second fault in a row, its window grows while what it maps gets used
+// -- even if the reclaimer cleared PTE_A in between -- and shrinks
+// when it doesn't, and scattered faults leave it alone.
+static void
+check_around(void)
+{
+	size_t nfree0 = page_nfree();
+	uint32_t nused0 = swap_nused, naround0 = naround, nused = naroundused;
+	uintptr_t base = UTEXT;
+	pde_t *pgdir;
+	pte_t *pte;
+	int i;
+
+	assert(vm_pgdir_alloc(&pgdir) == 0);
+	assert(vm_map_anon(pgdir, base, 64 * PGSIZE, PTE_W|PTE_U) == 0);
+
+	// one fault maps only its own page; the next starts a stream
+	assert(vm_fault(pgdir, base, FEC_U|FEC_WR) == 0);
+	assert(naround == naround0 && !check_in(pgdir, base, 1, 1));
+	assert(vm_fault(pgdir, base + PGSIZE, FEC_U|FEC_WR) == 0);
+	assert(naround == naround0 + 2 && check_in(pgdir, base, 2, 3));
+	assert(!check_in(pgdir, base, 4, 4));
+
+	// using all of it doubles the window
+	check_use(pgdir, base, 2, 3);
+	assert(vm_fault(pgdir, base + 4 * PGSIZE, FEC_U|FEC_WR) == 0);
+	assert(naroundused == nused + 2);
+	assert(naround == naround0 + 6 && check_in(pgdir, base, 5, 8));
+
+	// faults elsewhere, as many as there are streams, start none
+	for (i = 0; i <= NSTREAM; i++)
+		assert(vm_fault(pgdir, base + (40 + 2 * i) * PGSIZE,
+				FEC_U|FEC_WR) == 0);
+	assert(naround == naround0 + 6);
+
+	// the reclaimer clearing PTE_A doesn't hide the use
+	check_use(pgdir, base, 5, 63);
+	vm_reclaim(1);
+	for (i = 5; i <= 8; i++) {
+		assert(page_lookup(pgdir, (void *) (base + i * PGSIZE), &pte));
+		assert(!(*pte & PTE_A));
+	}
+	assert(vm_fault(pgdir, base + 9 * PGSIZE, FEC_U|FEC_WR) == 0);
+	assert(naroundused == nused + 6);
+	assert(naround == naround0 + 14 && check_in(pgdir, base, 10, 17));
+
+	// not using it halves the window
+	assert(vm_fault(pgdir, base + 18 * PGSIZE, FEC_U|FEC_WR) == 0);
+	assert(naroundused == nused + 6);
+	assert(naround == naround0 + 18 && check_in(pgdir, base, 19, 22));
+	assert(!check_in(pgdir, base, 23, 23));
+
+	vm_pgdir_free(pgdir);
+	assert(page_nfree() == nfree0);
+	assert(swap_nused == nused0);
+}
+
+// Check tlb_gather_commit's choice between invlpg and a flush, that it
+// drops batches for address spaces not in use, and that the pages it
+// was handed stay allocated until it's done.  The tlbstat counts are
+// put back afterwards.
+static void
+check_tlb_gather(void)
+{
+	extern pde_t entry_pgdir[];
+	uint32_t ninvlpg0 = tlb_ninvlpg, nflush0 = tlb_nflush;
+	uint32_t nglobal0 = tlb_nflush_global;
+	uint32_t i, lim = MIN(tlb_flush_ceiling, TLB_GATHER_MAX);
+	struct tlb_gather tg;
+	struct Page *pp, *pp2;
+	pde_t *pgdir;
+	size_t nfree0;
+
+	assert(vm_pgdir_alloc(&pgdir) == 0);
+	nfree0 = page_nfree();
+
+	// up to the ceiling, one invlpg a page
+	tlb_gather_init(&tg, entry_pgdir);
+	for (i = 0; i < lim; i++)
+		tlb_gather_add(&tg, (void *) (i * PGSIZE));
+	tlb_gather_commit(&tg);
+	assert(tlb_ninvlpg == ninvlpg0 + lim && tlb_nflush == nflush0);
+	assert(tg.tg_n == 0);
+
+	// past it, and past what the batch holds, a flush
+	tlb_gather_init(&tg, entry_pgdir);
+	for (i = 0; i <= lim; i++)
+		tlb_gather_add(&tg, (void *) (i * PGSIZE));
+	tlb_gather_commit(&tg);
+	for (i = 0; i < TLB_GATHER_MAX + 1; i++)
+		tlb_gather_add(&tg, (void *) (i * PGSIZE));
+	tlb_gather_commit(&tg);
+	assert(tlb_ninvlpg == ninvlpg0 + lim && tlb_nflush == nflush0 + 2);
+
+	// a flush for kernel mappings has to take the global ones too
+	for (i = 0; i <= lim; i++)
+		tlb_gather_add(&tg, (void *) (KERNBASE + i * PGSIZE));
+	tlb_gather_commit(&tg);
+	assert(tlb_nflush == nflush0 + 2 && tlb_nflush_global == nglobal0 + 1);
+
+	// Frees wait for the commit, even of a batch that needs no
+	// invalidating.  A page with references left isn't freed at all.
+	tlb_gather_init(&tg, pgdir);
+	assert(page_alloc(&pp, 0) == 0 && page_alloc(&pp2, 0) == 0);
+	pp->pp_ref = 1;
+	pp2->pp_ref = 2;
+	tlb_gather_add(&tg, (void *) 0);
+	tlb_gather_decref(&tg, pp);
+	tlb_gather_decref(&tg, pp2);
+	assert(pp->pp_ref == 0 && !(pp->pp_flags & PP_FREE));
+	assert(pp2->pp_ref == 1);
+	assert(page_nfree() == nfree0 - 2);
+	tlb_gather_commit(&tg);
+	assert(tlb_ninvlpg == ninvlpg0 + lim && tlb_nflush == nflush0 + 2);
+	assert(page_nfree() == nfree0 - 1);
+	page_decref(pp2);
+	assert(page_nfree() == nfree0);
+
+	vm_pgdir_free(pgdir);
+	tlb_ninvlpg = ninvlpg0;
+	tlb_nflush = nflush0;
+	tlb_nflush_global = nglobal0;
+}
+
+void
+check_vm(void)
+{
+	check_tlb_gather();
+	check_anon();
+	check_fork();
+	check_huge();
+	check_around();
+	cprintf("check_vm() succeeded!\n");
+}
@@ -0,0 +1,39 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_VM_H
+#define JOS_KERN_VM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+
+// What a page table entry that isn't present (no PTE_P) means to the
+// fault handler, in PTE_AVAIL bits.  Either way, the entry keeps the
+// PTE_W and PTE_U the page gets when it's brought in.
+#define PTE_ANON	0x200	// zero-filled on first touch
+#define PTE_SWAP	0x400	// in the swap slot at PTE_ADDR >> PGSHIFT
+
+// A present page that's shared read-only, and copied on the first
+// write, has this PTE_AVAIL bit instead of PTE_W.
+#define PTE_COW		0x800
+
+extern uint32_t vm_huge_min;
+
+void vm_init(void);
+int vm_pgdir_alloc(pde_t **pgdir_store);
+void vm_pgdir_free(pde_t *pgdir);
+int vm_fork(pde_t *dst, pde_t *src);
+int vm_map_anon(pde_t *pgdir, uintptr_t va, size_t len, int perm);
+void vm_unmap(pde_t *pgdir, uintptr_t va, size_t len);
+int vm_fault(pde_t *pgdir, uintptr_t va, uint32_t err);
+int vm_reclaim(int npages);
+void vm_page_forget(struct Page *pp);
+void vm_page_unshare(struct Page *pp);
+void vm_huge_split(struct Page *pp);
+struct Page *vm_anon_first(void);
+void vm_stat(void);
+void vm_stat_reset(void);
+void check_vm(void);
+
+#endif	// !JOS_KERN_VM_H